@@ -0,0 +1,85 @@
+// Latency of service requests through the transport, against a local
+// stand-in gateway: with new connection for every request, with kept alive
+// connections and with pipelining. Run with
+//     node benchmark/transport.js [requests]
+
+var http = require('http'),
+  transport = require('../transport');
+
+var requests = parseInt(process.argv[2], 10) || 2000;
+var request = new Buffer(150);  // about the size of a signing request
+var response = new Buffer(2500);  // about the size of a signing response
+request.fill(1);
+response.fill(2);
+
+var connections = 0;
+var gateway = http.createServer(function(req, res){
+  req.on('data', function(){});
+  req.on('end', function(){
+    res.writeHead(200, {'Content-Type': 'application/octet-stream',
+                        'Content-Length': response.length});
+    res.end(response);
+  });
+});
+gateway.on('connection', function(){ connections++; });
+
+// sends count requests, at most parallel at once; callback(latencies in ms)
+function run(where, count, parallel, callback){
+  var sent = 0, received = 0, latencies = [];
+  function send(){
+    var start = process.hrtime();
+    sent++;
+    transport.request(where, request, function(err, res){
+      if (err || res.statusCode != 200 || res.body.length != response.length)
+        throw err || new Error("Bad response");
+      var t = process.hrtime(start);
+      latencies.push(t[0] * 1e3 + t[1] / 1e6);
+      if (++received == count)
+        return callback(latencies);
+      if (sent < count)
+        send();
+    });
+  }
+  for (var i = 0; i < parallel && i < count; i++)
+    send();
+}
+
+function report(name, latencies, elapsed, opened){
+  latencies.sort(function(a, b){ return a - b; });
+  var sum = latencies.reduce(function(a, b){ return a + b; }, 0);
+  console.log(name + '  mean ' + (sum / latencies.length).toFixed(3) + ' ms' +
+      '  p99 ' + latencies[Math.floor(latencies.length * 0.99)].toFixed(3) + ' ms' +
+      '  ' + (latencies.length / elapsed * 1000).toFixed(0) + ' req/s' +
+      '  ' + opened + ' connections');
+}
+
+var scenarios = [
+  ['no keep-alive,  serial     ', { keepalive: false, pipelining: 1 }, 1],
+  ['keep-alive,     serial     ', { keepalive: true,  pipelining: 1 }, 1],
+  ['no keep-alive,  16 parallel', { keepalive: false, pipelining: 1 }, 16],
+  ['keep-alive,     16 parallel', { keepalive: true,  pipelining: 1 }, 16],
+  ['pipelining 4,   16 parallel', { keepalive: true,  pipelining: 4 }, 16]
+];
+
+gateway.listen(0, '127.0.0.1', function(){
+  var port = gateway.address().port;
+  function next(i){
+    if (i == scenarios.length)
+      return gateway.close();
+    var s = scenarios[i];
+    // separate endpoint for each scenario, so that no connections are carried over
+    var where = { hostname: '127.0.0.1', port: port, path: '/gt-signingservice/' + i,
+                  method: 'POST', maxinflight: s[2] > 1 ? 4 : 1 };
+    transport.configure(s[1]);
+    run(where, 100, s[2], function(){  // warm up
+      var before = connections, start = Date.now();
+      run(where, requests, s[2], function(latencies){
+        report(s[0], latencies, Date.now() - start, connections - before);
+        next(i + 1);
+      });
+    });
+  }
+  console.log(requests + ' requests of ' + request.length + ' bytes, responses of ' +
+      response.length + ' bytes; in-flight limit 4 per endpoint');
+  next(0);
+});
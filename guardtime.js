@@ -2,9 +2,12 @@ var crypto = require('crypto'),
   http = require('http'),
   url = require('url'),
   fs = require('fs'),
-  EventEmitter = require('events').EventEmitter;
+  EventEmitter = require('events').EventEmitter,
+  transport = require('./transport');
 
-var TimeSignature = require('bindings')('timesignature.node').TimeSignature;
+var binding = require('bindings')('timesignature.node'),
+  TimeSignature = binding.TimeSignature,
+  PublicationsFile = binding.PublicationsFile;
 
 var pubok = new EventEmitter();
 pubok.setMaxListeners(0);
@@ -25,8 +28,19 @@ var defaultconf = {
   signerthreads:       16,
   verifierthreads:     2,
   publicationsthreads: 1,
+  keepalive: true,
+  idlesockets: 4,
+  idletimeout: 30,
+  pipelining: 1,
+  hedgepercentile: 95,
+  extensionconcurrency: 8,
+  extensioncachesize: 1024,
   publicationsdata: '',
-  publicationslifetime: 60*60*7
+  publicationslifetime: 60*60*7,
+  publicationsrefresh: 60*30,
+  publicationsgrace: 60*60,
+  aggregationwindow: 0,
+  aggregationsize: 4096
 };
 
 function addprops(a, p){
@@ -41,11 +55,12 @@ function dorequest(where, what, inloop){
   var callback = arguments[arguments.length - 1];
     if (typeof(callback) !== 'function')
       callback = function (){};
-  where.headers = {'Content-Length': what.length};
-  var req = http.request(where, function(res) {
+  transport.request(where, what, function(err, res) {
+    if (err)
+      return callback(new Error("Service'" + where.href
+          + "' error: " + err.message));
     if (res.statusCode >= 301 && res.statusCode <= 307 ) {
       var elsewhere = addprops(where, url.parse(res.headers.location));
-      res.destroy();
       var loop = typeof(inloop) === 'number' ? inloop+1 : 0;
       if (loop  > 3)
         return callback(new Error("Redirect loop at " + elsewhere.href ));
@@ -53,25 +68,363 @@ function dorequest(where, what, inloop){
         return dorequest(elsewhere, what, loop, callback);
     }
     if (res.statusCode != 200) {
-      res.destroy();
       return callback(new Error("Service '" + where.href
           + "' error: " + res.statusCode
           + " (" + http.STATUS_CODES[res.statusCode] + ")"));
     }
-    var data = "";
-    res.on('data', function (chunk) {
-      data += chunk.toString('binary');
+    // body is a Buffer, which the native code reads in place
+    callback(null, res.body);
+  });
+}
+
+// service endpoint(s) given as URI or list of URIs. Service object itself is
+// addressed to the first one; endpoints keep request counts for balancing.
+function setendpoints(service, uris){
+  if (!Array.isArray(uris))
+    uris = [uris];
+  if (uris.length === 0)
+    throw new Error("Service URI list must not be empty.");
+  addprops(service, url.parse(uris[0]));
+  service.endpoints = uris.map(function(uri){
+    var endpoint = url.parse(uri);
+    endpoint.outstanding = 0;
+    return endpoint;
+  });
+  service.latencies = [];
+}
+
+function newservice(uri, method, threads){
+  var service = { method: method, maxinflight: threads };
+  setendpoints(service, uri);
+  return service;
+}
+
+// number of recent response latencies kept per service, and needed for hedging
+var LATENCY_SAMPLES = 64,
+  MIN_LATENCY_SAMPLES = 8;
+
+// endpoint with the fewest outstanding requests, other than exclude
+function pickendpoint(service, exclude){
+  var best = null;
+  service.endpoints.forEach(function(endpoint){
+    if (endpoint !== exclude && (!best || endpoint.outstanding < best.outstanding))
+      best = endpoint;
+  });
+  return best;
+}
+
+// ms to wait for response before sending a duplicate to another endpoint, -1 for no hedging
+function hedgedelay(service){
+  var percentile = GuardTime.hedging.percentile, samples = service.latencies;
+  if (!(percentile > 0) || service.endpoints.length < 2 || samples.length < MIN_LATENCY_SAMPLES)
+    return -1;
+  var sorted = samples.slice().sort(function(a, b){ return a - b; });
+  return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * percentile / 100))];
+}
+
+// sends request to the endpoint of service with the fewest outstanding requests. If it does
+// not answer within the hedging percentile of recent latencies, or fails, the request is sent
+// to another endpoint too. accept(data) returns result or throws if the response is not valid;
+// callback gets the result of the first accepted response, or the last error.
+function servicerequest(service, what, accept, callback){
+  var sent = 0, failed = 0, done = false, timer = null, first;
+
+  function send(exclude){
+    var endpoint = pickendpoint(service, exclude);
+    if (!endpoint)
+      return null;
+    endpoint.method = service.method;
+    endpoint.maxinflight = service.maxinflight;
+    endpoint.outstanding++;
+    sent++;
+    var start = Date.now();
+    dorequest(endpoint, what, function(err, data){
+      endpoint.outstanding--;
+      if (!err) {
+        service.latencies.push(Date.now() - start);
+        if (service.latencies.length > LATENCY_SAMPLES)
+          service.latencies.shift();
+      }
+      if (done)
+        return;
+      var result;
+      if (!err) {
+        try {
+          result = accept(data);
+        } catch (e) {
+          err = e;
+        }
+      }
+      if (!err || (++failed === sent && !hedge())) {
+        done = true;
+        clearTimeout(timer);
+        callback(err || null, result);
+      }
     });
-    res.on('end', function(){
-      callback(null, data);
+    return endpoint;
+  }
+
+  // sends the duplicate; false if not possible
+  function hedge(){
+    clearTimeout(timer);
+    return sent < 2 && send(first) !== null;
+  }
+
+  first = send(null);
+  var delay = hedgedelay(service);
+  if (delay >= 0)
+    timer = setTimeout(hedge, delay);
+}
+
+// sends a signing request for hash, callback gets DER token
+function signroot(hash, alg, callback){
+  var reqdata;
+  try {
+    reqdata = TimeSignature.composeRequest(hash, alg);
+  } catch (err) {
+    return callback(err);
+  }
+  servicerequest(GuardTime.service.signer, reqdata, TimeSignature.processResponse, callback);
+}
+
+// installs decoded and verified publications file; all fields change at once
+function setpublications(f, data){
+  var pub = GuardTime.publications;
+  pub.last = f.getLastPublicationTime();
+  pub.file = f;
+  pub.data = data;
+  pub.updatedat = Date.now();
+  // position of the background refresh in the refresh window, so that
+  // processes started together do not reload together
+  pub.jitter = Math.random();
+}
+
+var refreshing = false,
+  retryat = 0;
+
+// loads publications file unless already loading; result is emitted as 'pubOK'
+function refreshpublications(){
+  if (refreshing)
+    return;
+  refreshing = true;
+  GuardTime.loadPublications(function(err){
+    refreshing = false;
+    // retry a failed refresh in a minute, not on every verification
+    if (err)
+      retryat = Date.now() + 60*1000;
+    pubok.emit('pubOK', err);
+  });
+}
+
+// calls back when usable publications data is present. Data is refreshed in
+// background ahead of expiry and used up to the grace period past it;
+// callers wait only if there is no data or it is older than that.
+function withpublications(callback){
+  var pub = GuardTime.publications, now = Date.now();
+  var expires = pub.updatedat + pub.lifetime * 1000;
+  if (pub.file && now < expires + pub.grace * 1000) {
+    if (now >= expires - pub.jitter * Math.min(pub.refresh, pub.lifetime) * 1000 &&
+          now >= retryat)
+      refreshpublications();
+    return callback(null);
+  }
+  pubok.once('pubOK', callback);
+  refreshpublications();
+}
+
+// Extension scheduler. Extending request depends only on the aggregation round
+// of the token, so one request is sent per round, however many tokens wait
+// for it, and at most extension.concurrency rounds are fetched at once.
+var extensions = {},  // rounds waiting or being fetched, by request
+  extensionqueue = [],
+  extensionsrunning = 0;
+
+// Extending responses received, by history identifier and the last publication
+// they were requested with; least recently used ones are dropped first. Keys are
+// not integers, so that objects keep them in insertion order.
+var responses = {},
+  responsecount = 0,
+  responsestats = { hits: 0, misses: 0 };
+
+// cache key of token's round, or null if the response can not be cached
+function responsekey(ts){
+  var pubfile = GuardTime.publications.file;
+  if (!pubfile || !(GuardTime.extension.cachesize > 0 || GuardTime.extension.cachedir))
+    return null;
+  try {
+    return ts.getMetadata().registered_time.getTime() / 1000 + '-' +
+        pubfile.getLastPublicationTime().getTime() / 1000;
+  } catch (err) {
+    return null;
+  }
+}
+
+function forgetresponse(key){
+  if (responses.hasOwnProperty(key)) {
+    delete responses[key];
+    responsecount--;
+  }
+}
+
+function rememberresponse(key, data, persist){
+  forgetresponse(key);
+  if (GuardTime.extension.cachesize > 0) {
+    responses[key] = data;
+    responsecount++;
+    for (var oldest in responses) {
+      if (responsecount <= GuardTime.extension.cachesize)
+        break;
+      forgetresponse(oldest);
+    }
+  }
+  var dir = GuardTime.extension.cachedir;
+  if (persist && dir) {
+    // written next to the final name and renamed, so readers never see a partial file
+    var filename = dir + '/' + key, tmpname = filename + '.' + process.pid + '.tmp';
+    fs.writeFile(tmpname, data, function(err){
+      if (err)
+        return fs.unlink(tmpname, function(){});
+      fs.rename(tmpname, filename, function(){});
     });
+  }
+}
+
+// callback(response or null) from memory or from the cache directory
+function lookupresponse(key, callback){
+  if (responses.hasOwnProperty(key)) {
+    var data = responses[key];
+    rememberresponse(key, data, false);  // most recently used
+    return callback(data);
+  }
+  var dir = GuardTime.extension.cachedir;
+  if (!dir)
+    return callback(null);
+  fs.readFile(dir + '/' + key, function(err, data){
+    if (err || !data.length)
+      return callback(null);
+    rememberresponse(key, data, false);
+    callback(data);
+  });
+}
+
+// extends the token with the cached response if there is one, else queues it
+function queueextension(ts, callback){
+  var key = responsekey(ts);
+  if (key === null)
+    return queueround(ts, null, callback);
+  lookupresponse(key, function(data){
+    if (data) {
+      try {
+        if (ts.extend(data) === true) {
+          responsestats.hits++;
+          return callback(null, ts);
+        }
+      } catch (err) {}
+      forgetresponse(key);  // damaged entry or no extension in it, fetch again
+    }
+    responsestats.misses++;
+    queueround(ts, key, callback);
   });
-  req.on('error', function(e) {
-    return callback(new Error("Service'" + where.href
-        + "' error: " + e.message));
+}
+
+function queueround(ts, key, callback){
+  var request;
+  try {
+    request = ts.composeExtendingRequest();
+  } catch (err) {
+    return callback(err);
+  }
+  var round = request.toString('hex');
+  var entry = extensions[round];
+  if (!entry) {
+    entry = extensions[round] = { request: request, key: key, waiters: [] };
+    extensionqueue.push(round);
+  }
+  entry.waiters.push({ ts: ts, callback: callback });
+  pumpextensions();
+}
+
+function pumpextensions(){
+  while (extensionqueue.length > 0 && extensionsrunning < GuardTime.extension.concurrency) {
+    extensionsrunning++;
+    fetchextension(extensionqueue.shift());
+  }
+}
+
+function fetchextension(round){
+  var entry = extensions[round];
+  // response is accepted if it extends the first token; tokens joining meanwhile get it too.
+  // extend() returns a status code instead of true if the service can not extend yet.
+  servicerequest(GuardTime.service.verifier, entry.request, function(data){
+    if (entry.waiters[0].ts.extend(data) !== true)
+      throw new Error("Extending service did not extend the signature");
+    return data;
+  }, function(err, data){
+    delete extensions[round];
+    extensionsrunning--;
+    pumpextensions();
+    // the first token was extended with it, so the response is valid for the round
+    if (!err && entry.key !== null)
+      rememberresponse(entry.key, data, true);
+    entry.waiters.forEach(function(waiter, i){
+      if (err)
+        return waiter.callback(err);
+      try {
+        if (i > 0)  // the first one was extended when the response was accepted
+          waiter.ts.extend(data);
+      } catch (e) {
+        return waiter.callback(e);
+      }
+      waiter.callback(null, waiter.ts);
+    });
   });
-  req.write(what);
-  req.end();
+}
+
+// hashes waiting to be signed together, per hash algorithm
+var aggregation = {};
+
+function flushaggregation(alg){
+  var batch = aggregation[alg];
+  if (!batch)
+    return;
+  delete aggregation[alg];
+  clearTimeout(batch.timer);
+  var tree;
+  try {
+    tree = TimeSignature.aggregateHashes(batch.hashes, alg);
+  } catch (err) {
+    return batch.callbacks.forEach(function(cb){ cb(err); });
+  }
+  signroot(tree.root, alg, function(err, der){
+    batch.callbacks.forEach(function(cb, i){
+      if (err)
+        return cb(err);
+      try {
+        var ts = new TimeSignature(der);
+      } catch (err) {
+        return cb(err);
+      }
+      cb(null, ts, tree.chains[i]);
+    });
+  });
+}
+
+function aggregate(hash, alg, callback){
+  var batch = aggregation[alg];
+  if (!batch) {
+    batch = aggregation[alg] = { hashes: [], callbacks: [] };
+    batch.timer = setTimeout(function(){ flushaggregation(alg); },
+        GuardTime.aggregation.window);
+  }
+  batch.hashes.push(hash);
+  batch.callbacks.push(callback);
+  if (batch.hashes.length >= GuardTime.aggregation.size)
+    flushaggregation(alg);
+}
+
+// optional hash chain argument of verify functions
+function ischain(chain){
+  return typeof(chain) === 'string' || Buffer.isBuffer(chain);
 }
 
 
@@ -84,55 +437,131 @@ var GuardTime = module.exports = {
     PUBLICATION_CHECKED : 32
   },
   TimeSignature: TimeSignature,
+  PublicationsFile: PublicationsFile,
   publications: {
     data: '',
+    file: null,
     last: '',
     updatedat: 0,
-    lifetime: 60*60*7
+    jitter: 0,
+    lifetime: defaultconf.publicationslifetime,
+    refresh: defaultconf.publicationsrefresh,
+    grace: defaultconf.publicationsgrace
+  },
+  aggregation: {
+    window: defaultconf.aggregationwindow,
+    size: defaultconf.aggregationsize
+  },
+
+  hedging: {
+    percentile: defaultconf.hedgepercentile
+  },
+  extension: {
+    concurrency: defaultconf.extensionconcurrency,
+    store: null,
+    cachesize: defaultconf.extensioncachesize,
+    cachedir: null
   },
 
   service: {
-    signer: addprops(url.parse(defaultconf.signeruri),
-                  { method: 'POST',
-                    agent: addprops(new http.Agent(),
-                                    { maxSockets: defaultconf.signerthreads })
-                  }),
-    verifier: addprops(url.parse(defaultconf.verifieruri),
-                  { method: 'POST',
-                    agent: addprops(new http.Agent(),
-                                   { maxSockets: defaultconf.verifierthreads })
-                  }),
-    publications: addprops(url.parse(defaultconf.publicationsuri),
-                  { method: 'GET',
-                    agent: addprops(new http.Agent(),
-                                  { maxSockets: defaultconf.publicationsthreads })
-                  })
+    signer: newservice(defaultconf.signeruri, 'POST', defaultconf.signerthreads),
+    verifier: newservice(defaultconf.verifieruri, 'POST', defaultconf.verifierthreads),
+    publications: newservice(defaultconf.publicationsuri, 'GET', defaultconf.publicationsthreads)
   },
 
   conf: function (options) {  // prettify me!
     if (options.signeruri)
-      addprops(GuardTime.service.signer, url.parse(options.signeruri));
+      setendpoints(GuardTime.service.signer, options.signeruri);
     if (options.signerthreads)
-      GuardTime.service.signer.agent.maxSockets = options.signerthreads;
+      GuardTime.service.signer.maxinflight = options.signerthreads;
     if (options.verifieruri)
-      addprops(GuardTime.service.verifier, url.parse(options.verifieruri));
+      setendpoints(GuardTime.service.verifier, options.verifieruri);
     if (options.verifierthreads)
-      GuardTime.service.verifier.agent.maxSockets = options.verifierthreads;
+      GuardTime.service.verifier.maxinflight = options.verifierthreads;
     if (options.publicationsuri)
-      addprops(GuardTime.service.publications, url.parse(options.publicationsuri));
+      setendpoints(GuardTime.service.publications, options.publicationsuri);
     if (options.publicationsthreads)
-      GuardTime.service.publications.agent.maxSockets = options.publicationsthreads;
+      GuardTime.service.publications.maxinflight = options.publicationsthreads;
+    if (options.hedgepercentile !== undefined) {
+      if (! isFinite(options.hedgepercentile) || options.hedgepercentile < 0 || options.hedgepercentile > 100)
+          throw new Error("Hedging percentile must be a number from 0 to 100.");
+      GuardTime.hedging.percentile = options.hedgepercentile;
+    }
+    if (options.extensionconcurrency !== undefined) {
+      if (! isFinite(options.extensionconcurrency) || options.extensionconcurrency < 1)
+          throw new Error("Extension concurrency must be a positive number.");
+      GuardTime.extension.concurrency = options.extensionconcurrency;
+    }
+    if (options.extensionstore !== undefined) {
+      var store = options.extensionstore;
+      if (store !== null && (typeof(store.get) !== 'function' || typeof(store.set) !== 'function'))
+          throw new Error("Extension store must have get() and set() functions.");
+      GuardTime.extension.store = store;
+    }
+    if (options.extensioncachesize !== undefined) {
+      if (! isFinite(options.extensioncachesize) || options.extensioncachesize < 0)
+          throw new Error("Extension cache size must be a non-negative number.");
+      GuardTime.extension.cachesize = options.extensioncachesize;
+      for (var oldest in responses) {
+        if (responsecount <= options.extensioncachesize)
+          break;
+        forgetresponse(oldest);
+      }
+    }
+    if (options.extensioncachedir !== undefined)
+      GuardTime.extension.cachedir = options.extensioncachedir || null;
+    if (options.idlesockets !== undefined) {
+      if (! isFinite(options.idlesockets) || options.idlesockets < 0)
+          throw new Error("Number of idle sockets must be a non-negative number.");
+      transport.configure({ idlesockets: options.idlesockets });
+    }
+    if (options.idletimeout !== undefined) {
+      if (! isFinite(options.idletimeout) || options.idletimeout <= 0)
+          throw new Error("Idle socket timeout must be a positive number.");
+      transport.configure({ idletimeout: options.idletimeout * 1000 });
+    }
+    if (options.pipelining !== undefined) {
+      if (! isFinite(options.pipelining) || options.pipelining < 1)
+          throw new Error("Pipelining depth must be a positive number.");
+      transport.configure({ pipelining: options.pipelining });
+    }
+    if (options.keepalive !== undefined)
+      transport.configure({ keepalive: !!options.keepalive });
+    if (options.publicationscachefile !== undefined)
+      PublicationsFile.setVerificationCacheFile(options.publicationscachefile);
     if (options.publicationsdata) {
-      var d = TimeSignature.verifyPublications(options.publicationsdata); // exception on error
-      GuardTime.publications.last = d; // last publication datum
-      GuardTime.publications.data = options.publicationsdata;
-      GuardTime.publications.updatedat = Date.now();
+      var f = new PublicationsFile(options.publicationsdata); // exception on error
+      setpublications(f, options.publicationsdata);
+    }
+    if (options.publicationsfile) {
+      var f = PublicationsFile.load(options.publicationsfile); // exception on error
+      setpublications(f, undefined);
     }
     if (options.publicationslifetime) {
       if (! isFinite(options.publicationslifetime) || options.publicationslifetime <= 0)
           throw new Error("Publications data lifetime must be a positive number.");
       GuardTime.publications.lifetime = options.publicationslifetime;
     }
+    if (options.publicationsrefresh !== undefined) {
+      if (! isFinite(options.publicationsrefresh) || options.publicationsrefresh < 0)
+          throw new Error("Publications refresh window must be a non-negative number.");
+      GuardTime.publications.refresh = options.publicationsrefresh;
+    }
+    if (options.publicationsgrace !== undefined) {
+      if (! isFinite(options.publicationsgrace) || options.publicationsgrace < 0)
+          throw new Error("Publications grace period must be a non-negative number.");
+      GuardTime.publications.grace = options.publicationsgrace;
+    }
+    if (options.aggregationwindow !== undefined) {
+      if (! isFinite(options.aggregationwindow) || options.aggregationwindow < 0)
+          throw new Error("Aggregation window must be a non-negative number.");
+      GuardTime.aggregation.window = options.aggregationwindow;
+    }
+    if (options.aggregationsize !== undefined) {
+      if (! isFinite(options.aggregationsize) || options.aggregationsize < 1)
+          throw new Error("Aggregation size must be a positive number.");
+      GuardTime.aggregation.size = options.aggregationsize;
+    }
   },
 
   sign: function (data, callback) {
@@ -165,18 +594,14 @@ var GuardTime = module.exports = {
     var callback = arguments[arguments.length - 1];
     if (typeof(callback) !== 'function')
       callback = function (){};
-    var reqdata;
-    try {
-      reqdata = TimeSignature.composeRequest(hash, alg);
-    } catch (err) {
-      return callback(err);
-    }
+    if (GuardTime.aggregation.window > 0)
+      return aggregate(hash, alg, callback);
 
-    dorequest(GuardTime.service.signer, reqdata, function(err, data){
+    signroot(hash, alg, function(err, der){
       if (err)
         return callback(err);
       try {
-        var ts = new TimeSignature(TimeSignature.processResponse(data));
+        var ts = new TimeSignature(der);
         callback(null, ts);
       } catch (err) {
         return callback(err);
@@ -211,17 +636,14 @@ var GuardTime = module.exports = {
     if (typeof(callback) !== 'function')
       callback = function (){};
 
-    dorequest(GuardTime.service.publications, "", function(err, data){
+    var data;
+    servicerequest(GuardTime.service.publications, "", function(response){
+      data = response;
+      return new PublicationsFile(data); // exception on error
+    }, function(err, f){
       if (err)
         return callback(err);
-      try {
-        var d = TimeSignature.verifyPublications(data); // exception on error
-        GuardTime.publications.last = d;
-        GuardTime.publications.data = data;
-        GuardTime.publications.updatedat = Date.now();
-      } catch (err) {
-        return callback(err);
-      }
+      setpublications(f, data);
       callback(null);
     });
   },
@@ -237,87 +659,128 @@ var GuardTime = module.exports = {
     } catch (err) {
       return callback(err);
     }
-    dorequest(GuardTime.service.verifier, reqdata, function(err, data){
+    // token is changed by the first response that extends it
+    servicerequest(GuardTime.service.verifier, reqdata, function(data){
+      ts.extend(data);
+    }, function(err){
       if (err)
         return callback(err);
-      try{
-        ts.extend(data);
-      } catch (err) {
-        return callback(err);
-      }
       callback(null, ts);
     });
   },
 
-  verify: function(data, ts) {
+  // extends through the scheduler and the extension store; token may be a new object
+  extendQueued: function (ts) {
+    var callback = arguments[arguments.length - 1];
+    if (typeof(callback) !== 'function')
+      callback = function (){};
+
+    var store = GuardTime.extension.store;
+    if (!store)
+      return queueextension(ts, callback);
+    var key;
+    try {
+      key = crypto.createHash('sha256').update(ts.getContent()).digest('hex');
+    } catch (err) {
+      return callback(err);
+    }
+    store.get(key, function(err, der){
+      var xts = null;
+      if (!err && der) {
+        try {
+          xts = new TimeSignature(der);
+        } catch (e) {} // broken entry, extend again
+      }
+      if (xts && xts.isExtended())
+        return callback(null, xts);
+      queueextension(ts, function(err, xts){
+        if (!err && xts.isExtended())
+          store.set(key, xts.getContent(), function(){});
+        callback(err, xts);
+      });
+    });
+  },
+
+  // {capacity, entries, hits, misses} of the extending response cache
+  getExtensionCacheStats: function () {
+    return { capacity: GuardTime.extension.cachesize, entries: responsecount,
+             hits: responsestats.hits, misses: responsestats.misses };
+  },
+
+  verify: function(data, ts, chain) {
   var callback = arguments[arguments.length - 1];
     if (typeof(callback) !== 'function')
       callback = function (){};
+    if (!ischain(chain))
+      chain = null;
     try {
       var hash = crypto.createHash(ts.getHashAlgorithm());
       hash.update(data);
-      GuardTime.verifyHash(hash.digest(), ts.getHashAlgorithm(), ts, callback);
+      GuardTime.verifyHash(hash.digest(), ts.getHashAlgorithm(), ts, chain, callback);
     } catch (er) {
       return callback(er);
     }
   },
 
-  verifyHash: function(hash, alg, ts) {
+  verifyHash: function(hash, alg, ts, chain) {
     var callback = arguments[arguments.length - 1];
     if (typeof(callback) !== 'function')
       callback = function (){};
     var properties = {};
-    // if publications file is not yet downloaded or data too old - download once and recall itself
-    if (!GuardTime.publications.data ||
-          (GuardTime.publications.updatedat + GuardTime.publications.lifetime * 1000 < Date.now())) {
-      pubok.once('pubOK', function(err){
-        if (err)
-          callback(err);
-        else
-          GuardTime.verifyHash(hash, alg, ts, callback);
-      });
-      if (pubok.listeners('pubOK').length <= 1)
-        GuardTime.loadPublications( function(err){ pubok.emit('pubOK', err); } );
-      return;
-    }
-    try {
-      properties = ts.verify();
-      properties.verification_status |= ts.compareHash(hash, alg);
-      var is_new = ts.getRegisteredTime().getTime() > GuardTime.publications.last.getTime();
-      if (!ts.isExtended() && !is_new) {
-        return GuardTime.extend(ts, function(err, xts) {
-          if (err) {
-            //no failover:
-            // return callback(err);
-            //with failover:
-            xts = ts;
-          }
-          try {
-            properties = xts.verify();
-            properties.verification_status |= xts.compareHash(hash, alg);
-            properties.verification_status |= xts.checkPublication(GuardTime.publications.data);
-          } catch (err) { return callback(err); }
-          callback(null, properties.verification_status, properties);
-        });
+    // hash was signed as a leaf of an aggregation tree, token is for the root
+    if (ischain(chain)) {
+      try {
+        hash = TimeSignature.aggregationRoot(chain, hash);
+      } catch (err) {
+        return callback(err);
       }
-      properties.verification_status |= ts.checkPublication(GuardTime.publications.data);
-    } catch (err) {
-      return callback(err);
     }
-    callback(null, properties.verification_status, properties);
+    withpublications(function(err){
+      if (err)
+        return callback(err);
+      // same file throughout, even if a refresh replaces it meanwhile
+      var pubfile = GuardTime.publications.file;
+      try {
+        properties = ts.verify();
+        properties.verification_status |= ts.compareHash(hash, alg);
+        var is_new = ts.getRegisteredTime().getTime() > pubfile.getLastPublicationTime().getTime();
+        if (!ts.isExtended() && !is_new) {
+          return GuardTime.extendQueued(ts, function(err, xts) {
+            if (err) {
+              //no failover:
+              // return callback(err);
+              //with failover:
+              xts = ts;
+            }
+            try {
+              properties = xts.verify();
+              properties.verification_status |= xts.compareHash(hash, alg);
+              properties.verification_status |= xts.checkPublication(pubfile);
+            } catch (err) { return callback(err); }
+            callback(null, properties.verification_status, properties);
+          });
+        }
+        properties.verification_status |= ts.checkPublication(pubfile);
+      } catch (err) {
+        return callback(err);
+      }
+      callback(null, properties.verification_status, properties);
+    });
   },
 
-  verifyFile: function(filename, ts) {
+  verifyFile: function(filename, ts, chain) {
     var callback = arguments[arguments.length - 1];
     if (typeof(callback) !== 'function')
       callback = function (){};
+    if (!ischain(chain))
+      chain = null;
     try {
       var hash = crypto.createHash(ts.getHashAlgorithm());
       fs.createReadStream(filename, {'bufferSize': 128*1024})
         .on('data', function(chunk) { hash.update(chunk); })
         .on('error', callback)
         .on('end', function() {
-          GuardTime.verifyHash(hash.digest(), ts.getHashAlgorithm(), ts, callback);
+          GuardTime.verifyHash(hash.digest(), ts.getHashAlgorithm(), ts, chain, callback);
       });
     } catch (err) {
       return callback(err);
@@ -28,6 +28,7 @@
 #include <openssl/err.h>
 
 #include "gt_internal.h"
+#include "hashchain.h"
 
 #if (OPENSSL_VERSION_NUMBER < 0x00908000L) || defined(OPENSSL_NO_SHA256)
 #error "The default hash algorithm (SHA-256) is disabled!"
@@ -227,6 +228,26 @@ int GT_init(void)
 	}
 
 	res = threadSetup();
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+
+	res = GT_initDigestContexts();
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+
+	res = GT_initHashChainCache();
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+
+	res = GT_initPublicKeyCache();
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+
+	res = GT_initVerifiedFileCache();
 
 cleanup:
 
@@ -244,9 +265,13 @@ void GT_finalize(void)
 	}
 	/* In theory we should also check for init_count < 0, but
 	 * in practice nothing could be done in this case... */
+	GT_finalizePublicKeyCache();
+	GT_finalizeHashChainCache();
+	GT_finalizeDigestContexts();
 	threadCleanup();
 	OBJ_cleanup();
 	GTTruststore_finalize();
+	GT_finalizeVerifiedFileCache();
 	ERR_free_strings();
 	ERR_remove_state(0);
 	EVP_cleanup();
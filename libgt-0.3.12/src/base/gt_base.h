@@ -525,6 +525,66 @@ typedef struct GTPubFileVerificationInfo_st {
 	char *certificate;
 } GTPubFileVerificationInfo;
 
+/**
+ * \ingroup timestamps
+ * \brief This structure holds timestamp properties that are extracted
+ * from the structure of the timestamp without cryptographic checks.
+ *
+ * \note Values are not trusted before the timestamp is verified.
+ */
+typedef struct GTTimestampMetadata_st {
+	/**
+	 * The time when the Guardtime core registered the timestamp.
+	 * Extracted from the shape of the history hash chain.
+	 */
+	GT_Time_t64 registered_time;
+	/**
+	 * Timestamp issuer address within the Guardtime network.
+	 * See #GTTimeStampImplicit::location_id.
+	 */
+	GT_UInt64 location_id;
+	/**
+	 * Timestamp issuer name within the Guardtime network, NULL if
+	 * not present.
+	 */
+	char *location_name;
+	/**
+	 * Hash algorithm used to hash the datum.
+	 * See #GTHashAlgorithm for possible values.
+	 */
+	int hash_algorithm;
+	/**
+	 * Publication identifier of the published data in the timestamp.
+	 */
+	GT_Time_t64 publication_identifier;
+} GTTimestampMetadata;
+
+/**
+ * \ingroup verification
+ * \brief This structure holds statistics of the history hash chain cache.
+ *
+ * \see #GT_setHashChainCacheSize()
+ */
+typedef struct GTHashChainCacheStats_st {
+	/**
+	 * Maximum number of entries in the cache, 0 if the cache is disabled.
+	 */
+	size_t capacity;
+	/**
+	 * Current number of entries in the cache.
+	 */
+	size_t entries;
+	/**
+	 * Number of history chain calculations that were completed from the
+	 * cache.
+	 */
+	unsigned long hits;
+	/**
+	 * Number of history chain calculations that were not found in the cache.
+	 */
+	unsigned long misses;
+} GTHashChainCacheStats;
+
 /**
  * \ingroup common
  *
@@ -1004,6 +1064,36 @@ int GTTimestamp_isExtended(const GTTimestamp *timestamp);
 int GTTimestamp_isEarlierThan(const GTTimestamp *this_timestamp,
 		const GTTimestamp *that_timestamp);
 
+/**
+ * \ingroup timestamps
+ *
+ * Extracts registration time, issuer location, hash algorithm and
+ * publication identifier of the timestamp. Only the structure of the
+ * hash chains is examined, no hash values or signatures are computed;
+ * use #GTTimestamp_verify() to check that the values can be trusted.
+ *
+ * \param timestamp \c (in) - Pointer to the timestamp.
+ * \param metadata \c (out) - Pointer that will receive pointer to the
+ * metadata structure. Use #GTTimestampMetadata_free() to free it.
+ *
+ * \return status code \c GT_OK, when operation succeeded, otherwise an
+ * error code.
+ */
+int GTTimestamp_getMetadata(const GTTimestamp *timestamp,
+		GTTimestampMetadata **metadata);
+
+/**
+ * \ingroup timestamps
+ *
+ * Frees memory used by timestamp metadata.
+ *
+ * \param metadata \c (in) - \c GTTimestampMetadata object that is to be
+ * freed.
+ *
+ * \see #GT_free()
+ */
+void GTTimestampMetadata_free(GTTimestampMetadata *metadata);
+
 /**
  * \ingroup verification
  *
@@ -1023,6 +1113,57 @@ int GTTimestamp_isEarlierThan(const GTTimestamp *this_timestamp,
 int GTTimestamp_verify(const GTTimestamp *timestamp,
 		int parse_data, GTVerificationInfo **verification_info);
 
+/**
+ * \ingroup verification
+ *
+ * Same as #GTTimestamp_verify() for many timestamps at once. The hash
+ * chains of the timestamps are calculated together, which is faster than
+ * verifying the timestamps one by one.
+ *
+ * \param timestamps \c (in) - Array of \p count timestamps.
+ * \param count \c (in) - Number of timestamps.
+ * \param parse_data \c (in) - Same as for #GTTimestamp_verify().
+ * \param verification_infos \c (out) - Array of \p count pointers that will
+ * receive pointers to verification infos (\c NULL for timestamps that could
+ * not be verified).
+ * \param results \c (out) - Array of \p count status codes, one for every
+ * timestamp as returned by #GTTimestamp_verify().
+ *
+ * \return status code \c GT_OK, when operation succeeded, otherwise an
+ * error code. On success \p results should still be checked.
+ */
+int GTTimestamp_verifyBatch(const GTTimestamp *const *timestamps,
+		int count, int parse_data, GTVerificationInfo **verification_infos,
+		int *results);
+
+/**
+ * \ingroup verification
+ *
+ * Enables the history hash chain cache, that is shared by all threads.
+ * Timestamps issued in the same or nearby rounds have the same upper part
+ * of the history hash chain; with the cache the shared part is calculated
+ * only once when verifying many such timestamps. The cache is disabled by
+ * default.
+ *
+ * \param max_entries \c (in) - Maximum number of entries in the cache
+ * (rounded down to a power of two), or 0 to disable and free the cache.
+ * Setting the size clears the cache and its statistics.
+ *
+ * \return status code \c GT_OK, when operation succeeded, otherwise an
+ * error code.
+ */
+int GT_setHashChainCacheSize(size_t max_entries);
+
+/**
+ * \ingroup verification
+ *
+ * Returns statistics of the history hash chain cache.
+ *
+ * \param stats \c (out) - Pointer to the structure that receives the
+ * statistics.
+ */
+void GT_getHashChainCacheStats(GTHashChainCacheStats *stats);
+
 /**
  * \ingroup verification
  *
@@ -1158,6 +1299,50 @@ int GTDataHash_close(GTDataHash *data_hash);
  */
 void GTDataHash_free(GTDataHash *data_hash);
 
+/**
+ * \ingroup common
+ *
+ * Builds a hash tree on top of the given hashes, so that all of them can be
+ * timestamped with a single request for the root of the tree. For every leaf
+ * a hash chain is returned that links the leaf to the root.
+ * \see #GTDataHash_aggregationRoot
+ *
+ * \param leaves \c (in) - Array of pointers to the hashes to be aggregated.
+ * \param leaf_count \c (in) - Number of hashes in \p leaves.
+ * \param hash_algorithm \c (in) - Identifier of the hash algorithm used for
+ * the tree nodes. See #GTHashAlgorithm for possible values.
+ * \param root \c (out) - Pointer that will receive pointer to the root hash
+ * of the tree.
+ * \param hash_chains \c (out) - Array of \p leaf_count pointers that will
+ * receive the hash chains of the leaves. Each chain must be freed with
+ * #GT_free(). The chain is \c NULL if there is only one leaf.
+ * \param hash_chain_lengths \c (out) - Array of \p leaf_count lengths of
+ * the hash chains.
+ * \return status code (\c GT_OK, when operation succeeded, otherwise an
+ * error code).
+ */
+int GTDataHash_aggregate(const GTDataHash *const *leaves, int leaf_count,
+		int hash_algorithm, GTDataHash **root,
+		unsigned char **hash_chains, size_t *hash_chain_lengths);
+
+/**
+ * \ingroup common
+ *
+ * Calculates the root of the hash tree from a leaf and its hash chain
+ * returned by #GTDataHash_aggregate(). The result is to be compared with
+ * the hash in the timestamp of the tree root.
+ *
+ * \param leaf \c (in) - The leaf hash.
+ * \param hash_chain \c (in) - Hash chain of the leaf.
+ * \param hash_chain_length \c (in) - Length of the hash chain.
+ * \param root \c (out) - Pointer that will receive pointer to the root hash.
+ * \return status code (\c GT_OK, when operation succeeded, otherwise an
+ * error code).
+ */
+int GTDataHash_aggregationRoot(const GTDataHash *leaf,
+		const unsigned char *hash_chain, size_t hash_chain_length,
+		GTDataHash **root);
+
 /**
  * \ingroup common
  *
@@ -1186,6 +1371,60 @@ const char *GTHash_oid(int hash_algorithm);
 int GTPublicationsFile_DERDecode(const void *data, size_t data_length,
 		GTPublicationsFile **publications_file);
 
+/**
+ * \ingroup publications
+ *
+ * Decodes publications file from given byte string without copying it.
+ *
+ * \param data \c (in) - Pointer to buffer containing DER-encoded publications
+ * file. The buffer must stay valid and unchanged until the publications
+ * file is freed with #GTPublicationsFile_free().
+ * \param data_length \c (in) - Size of buffer pointed by \p data.
+ * \param publications_file \c (out) - Pointer that will receive pointer to
+ * decoded publications file.
+ * \return status code (\c GT_OK, when operation succeeded, otherwise an
+ * error code).
+ *
+ * \see #GTPublicationsFile_DERDecode()
+ */
+int GTPublicationsFile_DERDecodeBorrowed(const void *data, size_t data_length,
+		GTPublicationsFile **publications_file);
+
+/**
+ * \ingroup publications
+ *
+ * Maps publications file into memory read-only and decodes it in place.
+ * Processes that load the same file share one copy of its contents.
+ *
+ * \param path \c (in) - Name of the publications file.
+ * \param publications_file \c (out) - Pointer that will receive pointer to
+ * decoded publications file. The mapping is released by
+ * #GTPublicationsFile_free().
+ * \return status code (\c GT_OK, when operation succeeded, otherwise an
+ * error code). \c GT_IO_ERROR is returned if the file could not be opened
+ * or mapped; \c errno then holds the reason on POSIX systems.
+ *
+ * \note The file must not be modified while it is in use.
+ */
+int GTPublicationsFile_loadMapped(const char *path,
+		GTPublicationsFile **publications_file);
+
+/**
+ * \ingroup publications
+ *
+ * Returns the raw contents of the publications file.
+ *
+ * \param publications_file \c (in) - Pointer to publications file.
+ * \param data \c (out) - Pointer that will receive pointer to the contents,
+ * valid until the publications file is freed.
+ * \param data_length \c (out) - Pointer that will receive size of the
+ * contents.
+ * \return status code (\c GT_OK, when operation succeeded, otherwise an
+ * error code).
+ */
+int GTPublicationsFile_getData(const GTPublicationsFile *publications_file,
+		const void **data, size_t *data_length);
+
 /**
  * \ingroup publications
  *
@@ -1232,6 +1471,30 @@ int GTPublicationsFile_getKeyHashByIndex(
 int GTPublicationsFile_verify(const GTPublicationsFile *publications_file,
 		GTPubFileVerificationInfo **verification_info);
 
+/**
+ * \ingroup publications
+ *
+ * Sets the file where #GTPublicationsFile_verify() records the digests of
+ * the publications files it has verified, and where it looks them up
+ * before checking the signature again. Processes that set the same file
+ * share the results of their verifications. Successful verifications are
+ * remembered in memory until the signing certificate expires, also when no
+ * file is set. Setting the file forgets the verifications remembered in
+ * memory, so that files verified again are recorded in the new file.
+ *
+ * \param path \c (in) - Name of the cache file, \c NULL to stop using it.
+ * \return status code (\c GT_OK, when operation succeeded, otherwise an
+ * error code).
+ *
+ * \note A publications file listed in the cache file is accepted without
+ * checking its signature, so the cache file must be protected at least as
+ * well as the truststore, and shared only by processes that use the same
+ * truststore.
+ *
+ * \note Must be called after #GT_init().
+ */
+int GTPublicationsFile_setVerificationCacheFile(const char *path);
+
 /**
  * \ingroup publications
  *
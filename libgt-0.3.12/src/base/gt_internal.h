@@ -211,6 +211,30 @@ int GT_publishedDataToBase32(
  */
 int GT_isMallocFailure();
 
+/**
+ * Sets up the lock of the public key cache used for checking signatures
+ * of unextended timestamps. Called from \c GT_init().
+ */
+int GT_initPublicKeyCache(void);
+
+/**
+ * Frees the keys held by the public key cache. Called from
+ * \c GT_finalize().
+ */
+void GT_finalizePublicKeyCache(void);
+
+/**
+ * Sets up the lock of the cache of verified publications files. Called
+ * from \c GT_init().
+ */
+int GT_initVerifiedFileCache(void);
+
+/**
+ * Empties the cache of verified publications files and forgets the cache
+ * file. Called from \c GT_finalize().
+ */
+void GT_finalizeVerifiedFileCache(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,19 +27,29 @@
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #endif
 
 #include "gt_publicationsfile.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include <openssl/err.h>
 #include <openssl/pkcs7.h>
+#include <openssl/sha.h>
 #include <openssl/x509.h>
 
 #include "hashchain.h"
 #include "base32.h"
+#include "asn1_time_get.h"
 
 #ifdef _WIN32
 #define snprintf _snprintf
@@ -50,6 +60,8 @@
 
 /* Shared resourse initialized by #GTTruststore_init(). */
 extern X509_STORE *GT_truststore;
+/* Changed whenever the truststore is created or released. */
+extern unsigned int GT_truststore_generation;
 
 /*
  * Internal static function for reading network byte ordered 16-bit unsigned
@@ -161,6 +173,13 @@ static int decodeHeader(GTPublicationsFile *pubfile)
 		return GT_INVALID_FORMAT;
 	}
 
+	/* Identifiers are read from the cells before they are decoded, so each
+	 * cell must hold at least the identifier and the hash algorithm. */
+	if (pubfile->publication_cell_size <
+			GTPublicationsFile_CellOffset_publicationImprint + 1) {
+		return GT_INVALID_FORMAT;
+	}
+
 	data_block_size = pubfile->key_hashes_begin - pubfile->data_block_begin;
 	hash_data_block_size =
 		pubfile->signature_block_begin - pubfile->key_hashes_begin;
@@ -218,40 +237,95 @@ static int decodePublicationCell(
 }
 
 /*
- * Internal static function for decoding of the publication cells.
+ * Internal static function that reads the identifier of the publication
+ * cell without decoding the rest of it. Cell region bounds are checked by
+ * decodeHeader().
+ */
+static GT_HashDBIndex readPublicationIdentifier(
+		const GTPublicationsFile *pubfile, unsigned int cell_index)
+{
+	return readInt64(pubfile->data + pubfile->data_block_begin +
+			(size_t) cell_index * pubfile->publication_cell_size +
+			GTPublicationsFile_CellOffset_publicationIdentifier);
+}
+
+/*
+ * Internal static function for comparing of the publication index
+ * entries; cell index makes the order of equal identifiers stable.
  */
-static int decodePublicationCells(GTPublicationsFile *pubfile)
+static int compareIdentIndexEntries(const void *a, const void *b)
+{
+	const GTPublicationsFile_IdentIndexEntry *x = a;
+	const GTPublicationsFile_IdentIndexEntry *y = b;
+
+	if (x->publication_identifier != y->publication_identifier) {
+		return x->publication_identifier < y->publication_identifier ? -1 : 1;
+	}
+	if (x->cell_index != y->cell_index) {
+		return x->cell_index < y->cell_index ? -1 : 1;
+	}
+	return 0;
+}
+
+/*
+ * Internal static function for building of the publication identifier
+ * index. Only the identifiers are read; publications are normally in
+ * ascending order already, in which case no index is needed.
+ */
+static int indexPublicationCells(GTPublicationsFile *pubfile)
 {
 	unsigned int i;
-	int rc;
-	size_t cell_offset;
-	const unsigned char *cell_addr;
-	GTPublicationsFile_Cell *cell;
+	GTPublicationsFile_IdentIndexEntry *entry;
+
+	assert(pubfile->publication_index == NULL);
 
-	assert(pubfile->publication_cells == NULL);
+	for (i = 1; i < pubfile->number_of_publications; ++i) {
+		if (readPublicationIdentifier(pubfile, i - 1) >
+				readPublicationIdentifier(pubfile, i)) {
+			break;
+		}
+	}
+	if (i >= pubfile->number_of_publications) {
+		return GT_OK;
+	}
 
-	pubfile->publication_cells = GT_malloc(
-			sizeof(GTPublicationsFile_Cell) * pubfile->number_of_publications);
-	if (pubfile->publication_cells == NULL) {
+	pubfile->publication_index = GT_malloc(
+			sizeof(GTPublicationsFile_IdentIndexEntry) *
+			pubfile->number_of_publications);
+	if (pubfile->publication_index == NULL) {
 		return GT_OUT_OF_MEMORY;
 	}
 
 	for (i = 0; i < pubfile->number_of_publications; ++i) {
-		cell_offset = pubfile->data_block_begin +
-			i * pubfile->publication_cell_size;
-		cell_addr = pubfile->data + cell_offset;
-		cell = pubfile->publication_cells + i;
-
-		rc = decodePublicationCell(
-				cell_addr, cell_offset, pubfile->publication_cell_size, cell);
-		if (rc != GT_OK) {
-			return rc;
-		}
+		entry = pubfile->publication_index + i;
+		entry->publication_identifier = readPublicationIdentifier(pubfile, i);
+		entry->cell_index = i;
 	}
 
+	qsort(pubfile->publication_index, pubfile->number_of_publications,
+			sizeof(GTPublicationsFile_IdentIndexEntry),
+			compareIdentIndexEntries);
+
 	return GT_OK;
 }
 
+/*
+ * Internal static function that returns the identifier at the given
+ * position of the identifier order and the index of its cell.
+ */
+static GT_HashDBIndex getIndexedIdentifier(
+		const GTPublicationsFile *pubfile, unsigned int position,
+		unsigned int *cell_index)
+{
+	if (pubfile->publication_index == NULL) {
+		*cell_index = position;
+		return readPublicationIdentifier(pubfile, position);
+	}
+
+	*cell_index = pubfile->publication_index[position].cell_index;
+	return pubfile->publication_index[position].publication_identifier;
+}
+
 /*
  * Internal static function for decoding of the single key hash cell.
  */
@@ -335,6 +409,67 @@ static int decodeKeyHashCells(GTPublicationsFile *pubfile)
 	return GT_OK;
 }
 
+/*
+ * Internal static function that returns the first slot to probe for the
+ * given key hash imprint. The imprint bytes after the algorithm byte are
+ * a hash value, so they are used directly.
+ */
+static size_t keyHashSlot(
+		const unsigned char *imprint, size_t imprint_length, size_t mask)
+{
+	size_t h = imprint[0];
+	size_t i;
+
+	for (i = 1; i < imprint_length && i <= sizeof(size_t); ++i) {
+		h = (h << 8) ^ imprint[i];
+	}
+
+	return h & mask;
+}
+
+/*
+ * Internal static function for building of the key hash index. Cells are
+ * inserted in file order, so that lookup finds the first of equal imprints
+ * as the linear scan did.
+ */
+static int indexKeyHashCells(GTPublicationsFile *pubfile)
+{
+	unsigned int i;
+	size_t slots = 1;
+	size_t slot;
+	const GTPublicationsFile_KeyHashCell *cell;
+	const unsigned char *imprint;
+
+	assert(pubfile->key_hash_index == NULL);
+
+	/* Keep the table at most half full. */
+	while (slots < 2 * (size_t) pubfile->number_of_key_hashes) {
+		slots *= 2;
+	}
+
+	pubfile->key_hash_index = GT_calloc(slots, sizeof(unsigned int));
+	if (pubfile->key_hash_index == NULL) {
+		return GT_OUT_OF_MEMORY;
+	}
+	pubfile->key_hash_index_mask = slots - 1;
+	pubfile->key_hash_algorithms = 0;
+
+	for (i = 0; i < pubfile->number_of_key_hashes; ++i) {
+		cell = pubfile->key_hash_cells + i;
+		imprint = pubfile->data + cell->key_hash_imprint_offset;
+		pubfile->key_hash_algorithms |= 1u << imprint[0];
+
+		slot = keyHashSlot(imprint, cell->key_hash_imprint_size,
+				pubfile->key_hash_index_mask);
+		while (pubfile->key_hash_index[slot] != 0) {
+			slot = (slot + 1) & pubfile->key_hash_index_mask;
+		}
+		pubfile->key_hash_index[slot] = i + 1;
+	}
+
+	return GT_OK;
+}
+
 /*
  * Internal static function for decoding of the publication reference.
  */
@@ -379,7 +514,11 @@ static int decodeSignature(GTPublicationsFile *pubfile)
 
 /**/
 
-int GTPublicationsFile_DERDecode(const void *data, size_t data_length,
+/*
+ * Internal static function for decoding of the publications file in place;
+ * the result borrows the data.
+ */
+static int decodePublicationsFile(const void *data, size_t data_length,
 		GTPublicationsFile **publications_file)
 {
 	int retval = GT_UNKNOWN_ERROR;
@@ -396,13 +535,12 @@ int GTPublicationsFile_DERDecode(const void *data, size_t data_length,
 		goto cleanup;
 	}
 
-	/* Do not waste time with copying of data until we are sure that input data
-	 * is correct. */
 	tmp_publications_file->data = data;
 	tmp_publications_file->data_length = data_length;
-	tmp_publications_file->data_owner = 0;
-	tmp_publications_file->publication_cells = NULL;
+	tmp_publications_file->data_owner = GTPublicationsFile_DataBorrowed;
+	tmp_publications_file->publication_index = NULL;
 	tmp_publications_file->key_hash_cells = NULL;
+	tmp_publications_file->key_hash_index = NULL;
 	tmp_publications_file->pub_reference = NULL;
 	tmp_publications_file->signature = NULL;
 
@@ -411,7 +549,7 @@ int GTPublicationsFile_DERDecode(const void *data, size_t data_length,
 		goto cleanup;
 	}
 
-	retval = decodePublicationCells(tmp_publications_file);
+	retval = indexPublicationCells(tmp_publications_file);
 	if (retval != GT_OK) {
 		goto cleanup;
 	}
@@ -421,6 +559,11 @@ int GTPublicationsFile_DERDecode(const void *data, size_t data_length,
 		goto cleanup;
 	}
 
+	retval = indexKeyHashCells(tmp_publications_file);
+	if (retval != GT_OK) {
+		goto cleanup;
+	}
+
 	retval = decodePubReference(tmp_publications_file);
 	if (retval != GT_OK) {
 		goto cleanup;
@@ -431,16 +574,45 @@ int GTPublicationsFile_DERDecode(const void *data, size_t data_length,
 		goto cleanup;
 	}
 
+	*publications_file = tmp_publications_file;
+	tmp_publications_file = NULL;
+
+	retval = GT_OK;
+
+cleanup:
+
+	GTPublicationsFile_free(tmp_publications_file);
+
+	return retval;
+}
+
+/**/
+
+int GTPublicationsFile_DERDecode(const void *data, size_t data_length,
+		GTPublicationsFile **publications_file)
+{
+	int retval = GT_UNKNOWN_ERROR;
+	GTPublicationsFile *tmp_publications_file = NULL;
+	void *tmp_data;
+
+	/* Do not waste time with copying of data until we are sure that input data
+	 * is correct. */
+	retval = decodePublicationsFile(data, data_length, &tmp_publications_file);
+	if (retval != GT_OK) {
+		goto cleanup;
+	}
+
 	retval = GT_UNKNOWN_ERROR;
 
-	tmp_publications_file->data = GT_malloc(data_length);
-	if (tmp_publications_file->data == NULL) {
+	tmp_data = GT_malloc(data_length);
+	if (tmp_data == NULL) {
 		retval = GT_OUT_OF_MEMORY;
 		goto cleanup;
 	}
 
-	memcpy((void*) tmp_publications_file->data, data, data_length);
-	tmp_publications_file->data_owner = 1;
+	memcpy(tmp_data, data, data_length);
+	tmp_publications_file->data = tmp_data;
+	tmp_publications_file->data_owner = GTPublicationsFile_DataOwned;
 
 	*publications_file = tmp_publications_file;
 	tmp_publications_file = NULL;
@@ -456,6 +628,179 @@ cleanup:
 
 /**/
 
+int GTPublicationsFile_DERDecodeBorrowed(const void *data, size_t data_length,
+		GTPublicationsFile **publications_file)
+{
+	return decodePublicationsFile(data, data_length, publications_file);
+}
+
+/**/
+
+#ifdef _WIN32
+
+int GTPublicationsFile_loadMapped(const char *path,
+		GTPublicationsFile **publications_file)
+{
+	int retval = GT_UNKNOWN_ERROR;
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+	LARGE_INTEGER size;
+	void *data = NULL;
+	GTPublicationsFile *tmp_publications_file = NULL;
+
+	if (path == NULL || publications_file == NULL) {
+		retval = GT_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &size)) {
+		retval = GT_IO_ERROR;
+		goto cleanup;
+	}
+
+	if (size.QuadPart == 0 || (ULONGLONG) size.QuadPart > (size_t) -1) {
+		retval = GT_INVALID_FORMAT;
+		goto cleanup;
+	}
+
+	mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL) {
+		retval = GT_IO_ERROR;
+		goto cleanup;
+	}
+
+	data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL) {
+		retval = GT_IO_ERROR;
+		goto cleanup;
+	}
+
+	retval = decodePublicationsFile(data, (size_t) size.QuadPart,
+			&tmp_publications_file);
+	if (retval != GT_OK) {
+		goto cleanup;
+	}
+
+	tmp_publications_file->data_owner = GTPublicationsFile_DataMapped;
+	data = NULL;
+
+	*publications_file = tmp_publications_file;
+	tmp_publications_file = NULL;
+
+cleanup:
+
+	if (data != NULL) {
+		UnmapViewOfFile(data);
+	}
+	/* The view stays valid after the handles are closed. */
+	if (mapping != NULL) {
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+	}
+
+	return retval;
+}
+
+/**/
+
+static void unmapData(const void *data, size_t data_length)
+{
+	UnmapViewOfFile(data);
+}
+
+#else /* _WIN32 */
+
+int GTPublicationsFile_loadMapped(const char *path,
+		GTPublicationsFile **publications_file)
+{
+	int retval = GT_UNKNOWN_ERROR;
+	int fd = -1;
+	struct stat st;
+	void *data = MAP_FAILED;
+	size_t data_length = 0;
+	GTPublicationsFile *tmp_publications_file = NULL;
+
+	if (path == NULL || publications_file == NULL) {
+		retval = GT_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		retval = GT_IO_ERROR;
+		goto cleanup;
+	}
+
+	if (st.st_size <= 0 || (unsigned long long) st.st_size > (size_t) -1) {
+		retval = GT_INVALID_FORMAT;
+		goto cleanup;
+	}
+	data_length = (size_t) st.st_size;
+
+	/* Shared mapping, so that all processes using the file share the
+	 * same pages. */
+	data = mmap(NULL, data_length, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		retval = GT_IO_ERROR;
+		goto cleanup;
+	}
+
+	retval = decodePublicationsFile(data, data_length, &tmp_publications_file);
+	if (retval != GT_OK) {
+		goto cleanup;
+	}
+
+	tmp_publications_file->data_owner = GTPublicationsFile_DataMapped;
+	data = MAP_FAILED;
+
+	*publications_file = tmp_publications_file;
+	tmp_publications_file = NULL;
+
+cleanup:
+
+	if (data != MAP_FAILED) {
+		munmap(data, data_length);
+	}
+	if (fd >= 0) {
+		/* Keep errno of the failed call. */
+		int saved_errno = errno;
+		close(fd);
+		errno = saved_errno;
+	}
+
+	return retval;
+}
+
+/**/
+
+static void unmapData(const void *data, size_t data_length)
+{
+	munmap((void*) data, data_length);
+}
+
+#endif /* not _WIN32 */
+
+/**/
+
+int GTPublicationsFile_getData(const GTPublicationsFile *publications_file,
+		const void **data, size_t *data_length)
+{
+	if (publications_file == NULL || data == NULL || data_length == NULL) {
+		return GT_INVALID_ARGUMENT;
+	}
+
+	*data = publications_file->data;
+	*data_length = publications_file->data_length;
+
+	return GT_OK;
+}
+
+/**/
+
 int GTPublicationsFile_getSigningCert(
 		const GTPublicationsFile *publications_file,
 		unsigned char **cert_der, size_t *cert_der_length)
@@ -542,6 +887,39 @@ int GTPublicationsFile_getKeyHash(const GTPublicationsFile* publications_file,
 
 /**/
 
+int GTPublicationsFile_findKeyHash(
+		const GTPublicationsFile *publications_file,
+		const unsigned char *imprint, size_t imprint_length)
+{
+	size_t slot;
+	unsigned int cell_index;
+	const GTPublicationsFile_KeyHashCell *cell;
+
+	assert(publications_file != NULL);
+	assert(publications_file->key_hash_index != NULL);
+
+	if (imprint == NULL || imprint_length == 0) {
+		return -1;
+	}
+
+	slot = keyHashSlot(imprint, imprint_length,
+			publications_file->key_hash_index_mask);
+	while ((cell_index = publications_file->key_hash_index[slot]) != 0) {
+		cell = publications_file->key_hash_cells + cell_index - 1;
+		if (cell->key_hash_imprint_size == imprint_length &&
+				memcmp(publications_file->data +
+					cell->key_hash_imprint_offset,
+					imprint, imprint_length) == 0) {
+			return cell_index - 1;
+		}
+		slot = (slot + 1) & publications_file->key_hash_index_mask;
+	}
+
+	return -1;
+}
+
+/**/
+
 int GTPublicationsFile_getKeyHashByIndex(
 		const GTPublicationsFile *publications_file,
 		unsigned int key_hash_index, char **key_hash)
@@ -588,36 +966,31 @@ cleanup:
 	return res;
 }
 
-/* Helper function to get publication cell by index. */
+/* Helper function to get publication cell by index; cells are decoded on
+ * access. */
 static int getPublicationCell(
 		const GTPublicationsFile *publications_file,
 		unsigned int cell_index,
 		const GTPublicationsFile_Cell **cell,
 		GTPublicationsFile_Cell *decode_buffer)
 {
-	assert(cell_index < publications_file->number_of_publications);
+	size_t cell_offset;
+	const unsigned char *cell_addr;
+	int retval;
 
-	if (publications_file->publication_cells == NULL) {
-		size_t cell_offset;
-		const unsigned char *cell_addr;
-		int retval;
+	assert(cell_index < publications_file->number_of_publications);
 
-		cell_offset = publications_file->data_block_begin +
-			cell_index * publications_file->publication_cell_size;
-		cell_addr = publications_file->data + cell_offset;
+	cell_offset = publications_file->data_block_begin +
+		cell_index * publications_file->publication_cell_size;
+	cell_addr = publications_file->data + cell_offset;
 
-		retval = decodePublicationCell(cell_addr, cell_offset,
-				publications_file->publication_cell_size, decode_buffer);
-		if (retval == GT_OK) {
-			*cell = decode_buffer;
-		}
-
-		return retval;
+	retval = decodePublicationCell(cell_addr, cell_offset,
+			publications_file->publication_cell_size, decode_buffer);
+	if (retval == GT_OK) {
+		*cell = decode_buffer;
 	}
 
-	*cell = publications_file->publication_cells + cell_index;
-
-	return GT_OK;
+	return retval;
 }
 
 /* Helper function to create \p GTPubFileVerificationInfo. */
@@ -892,18 +1265,14 @@ cleanup:
 
 /**/
 
-int GTPublicationsFile_verify(const GTPublicationsFile *publications_file,
-		GTPubFileVerificationInfo **verification_info)
+/* Checks the signature of the publications file and traces the signing
+ * cert to a trusted CA root. */
+static int checkSignature(const GTPublicationsFile *publications_file)
 {
 	int res = GT_UNKNOWN_ERROR;
 	BIO *bio_in = NULL;
 	int rc;
 
-	if (publications_file == NULL || publications_file->signature == NULL) {
-		res = GT_INVALID_ARGUMENT;
-		goto cleanup;
-	}
-
 	/* Note that the cast to void * is needed in order to work around
 	 * const-noncorrectness in the OpenSSL API --- this pointer is used
 	 * only for reading. */
@@ -933,14 +1302,274 @@ int GTPublicationsFile_verify(const GTPublicationsFile *publications_file,
 #else
 	res = checkCertOpenSSL(publications_file);
 #endif
-	if (res != GT_OK) {
+
+cleanup:
+	BIO_free(bio_in);
+
+	return res;
+}
+
+/**/
+
+/*
+ * Cache of verified publications files. The same publications file is
+ * reloaded and verified many times before the next one is published, so
+ * the files that passed checkSignature() are remembered by the SHA-256
+ * digest of their contents until the signing cert expires. Entries made
+ * before a change of the truststore are not used. Optionally the entries
+ * are also kept in a file, to be shared with other processes.
+ */
+
+#define VERIFIED_FILE_CACHE_SIZE 4
+
+/* Length of the hex encoded digest in the cache file lines. */
+#define VERIFIED_FILE_DIGEST_HEX_LENGTH (2 * SHA256_DIGEST_LENGTH)
+
+typedef struct {
+	unsigned char file_digest[SHA256_DIGEST_LENGTH];
+	GT_Time_t64 valid_until;
+	unsigned int truststore_generation;
+	int used;
+} VerifiedFileCacheEntry;
+
+static VerifiedFileCacheEntry verified_file_cache[VERIFIED_FILE_CACHE_SIZE];
+/* Slot to be replaced next. */
+static int verified_file_cache_next = 0;
+/* Name of the cache file, NULL if not used. */
+static char *verified_file_cache_path = NULL;
+
+#ifdef _WIN32
+static HANDLE verified_file_cache_lock = NULL;
+#define LOCK_VERIFIED_FILE_CACHE() \
+	WaitForSingleObject(verified_file_cache_lock, INFINITE)
+#define UNLOCK_VERIFIED_FILE_CACHE() ReleaseMutex(verified_file_cache_lock)
+#else /* _WIN32 */
+static pthread_mutex_t verified_file_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_VERIFIED_FILE_CACHE() \
+	pthread_mutex_lock(&verified_file_cache_lock)
+#define UNLOCK_VERIFIED_FILE_CACHE() \
+	pthread_mutex_unlock(&verified_file_cache_lock)
+#endif /* not _WIN32 */
+
+/**/
+
+int GT_initVerifiedFileCache(void)
+{
+#ifdef _WIN32
+	if (verified_file_cache_lock == NULL) {
+		verified_file_cache_lock = CreateMutex(NULL, FALSE, NULL);
+		if (verified_file_cache_lock == NULL) {
+			return GT_OUT_OF_MEMORY;
+		}
+	}
+#endif /* _WIN32 */
+
+	return GT_OK;
+}
+
+/**/
+
+void GT_finalizeVerifiedFileCache(void)
+{
+	memset(verified_file_cache, 0, sizeof(verified_file_cache));
+	verified_file_cache_next = 0;
+	GT_free(verified_file_cache_path);
+	verified_file_cache_path = NULL;
+#ifdef _WIN32
+	if (verified_file_cache_lock != NULL) {
+		CloseHandle(verified_file_cache_lock);
+		verified_file_cache_lock = NULL;
+	}
+#endif /* _WIN32 */
+}
+
+/**/
+
+int GTPublicationsFile_setVerificationCacheFile(const char *path)
+{
+	char *tmp_path = NULL;
+
+	if (path != NULL) {
+		tmp_path = GT_malloc(strlen(path) + 1);
+		if (tmp_path == NULL) {
+			return GT_OUT_OF_MEMORY;
+		}
+		strcpy(tmp_path, path);
+	}
+
+	LOCK_VERIFIED_FILE_CACHE();
+	GT_free(verified_file_cache_path);
+	verified_file_cache_path = tmp_path;
+	/* Files found in memory would not be recorded in the new file. */
+	memset(verified_file_cache, 0, sizeof(verified_file_cache));
+	verified_file_cache_next = 0;
+	UNLOCK_VERIFIED_FILE_CACHE();
+
+	return GT_OK;
+}
+
+/**/
+
+static void digestToHex(const unsigned char *digest, char *hex)
+{
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < SHA256_DIGEST_LENGTH; ++i) {
+		hex[2 * i] = digits[digest[i] >> 4];
+		hex[2 * i + 1] = digits[digest[i] & 0x0f];
+	}
+	hex[VERIFIED_FILE_DIGEST_HEX_LENGTH] = '\0';
+}
+
+/**/
+
+/* Adds the file to the cache; the lock must be held. */
+static void addVerifiedFile(
+		const unsigned char *file_digest, GT_Time_t64 valid_until)
+{
+	VerifiedFileCacheEntry *entry =
+		&verified_file_cache[verified_file_cache_next];
+
+	verified_file_cache_next =
+		(verified_file_cache_next + 1) % VERIFIED_FILE_CACHE_SIZE;
+	memcpy(entry->file_digest, file_digest, SHA256_DIGEST_LENGTH);
+	entry->valid_until = valid_until;
+	entry->truststore_generation = GT_truststore_generation;
+	entry->used = 1;
+}
+
+/**/
+
+/* Looks the file up in the cache file; the lock must be held. Lines of the
+ * cache file consist of the hex encoded digest and the expiry time. */
+static int findVerifiedFileOnDisk(const unsigned char *file_digest,
+		GT_Time_t64 now, GT_Time_t64 *valid_until)
+{
+	FILE *f;
+	char hex[VERIFIED_FILE_DIGEST_HEX_LENGTH + 1];
+	char line[VERIFIED_FILE_DIGEST_HEX_LENGTH + 32];
+	GT_Time_t64 expiry;
+	int found = 0;
+
+	f = fopen(verified_file_cache_path, "r");
+	if (f == NULL) {
+		return 0;
+	}
+
+	digestToHex(file_digest, hex);
+	while (!found && fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, hex, VERIFIED_FILE_DIGEST_HEX_LENGTH) != 0 ||
+				line[VERIFIED_FILE_DIGEST_HEX_LENGTH] != ' ') {
+			continue;
+		}
+		expiry = strtoul(line + VERIFIED_FILE_DIGEST_HEX_LENGTH + 1, NULL, 10);
+		if (now <= expiry) {
+			*valid_until = expiry;
+			found = 1;
+		}
+	}
+
+	fclose(f);
+
+	return found;
+}
+
+/**/
+
+/* Returns non-zero if the file has been verified under the current
+ * truststore and the signing cert has not expired since. */
+static int isVerifiedFile(const unsigned char *file_digest)
+{
+	GT_Time_t64 now = time(NULL);
+	GT_Time_t64 valid_until;
+	int found = 0;
+	int i;
+
+	LOCK_VERIFIED_FILE_CACHE();
+	for (i = 0; i < VERIFIED_FILE_CACHE_SIZE && !found; ++i) {
+		if (verified_file_cache[i].used &&
+				verified_file_cache[i].truststore_generation ==
+					GT_truststore_generation &&
+				now <= verified_file_cache[i].valid_until &&
+				memcmp(verified_file_cache[i].file_digest, file_digest,
+					SHA256_DIGEST_LENGTH) == 0) {
+			found = 1;
+		}
+	}
+	if (!found && verified_file_cache_path != NULL &&
+			findVerifiedFileOnDisk(file_digest, now, &valid_until)) {
+		addVerifiedFile(file_digest, valid_until);
+		found = 1;
+	}
+	UNLOCK_VERIFIED_FILE_CACHE();
+
+	return found;
+}
+
+/**/
+
+/* Adds the verified file to the cache, and to the cache file if one is
+ * set. Errors are ignored, the file is just verified again next time. */
+static void rememberVerifiedFile(const GTPublicationsFile *publications_file,
+		const unsigned char *file_digest)
+{
+	STACK_OF(X509) *certs = NULL;
+	GT_Time_t64 valid_until;
+	char hex[VERIFIED_FILE_DIGEST_HEX_LENGTH + 1];
+	FILE *f;
+
+	certs = PKCS7_get0_signers(publications_file->signature, NULL, 0);
+	if (certs == NULL || sk_X509_num(certs) != 1 ||
+			GT_ASN1_TIME_get(X509_get_notAfter(sk_X509_value(certs, 0)),
+				&valid_until) != GT_OK) {
+		goto cleanup;
+	}
+
+	LOCK_VERIFIED_FILE_CACHE();
+	addVerifiedFile(file_digest, valid_until);
+	if (verified_file_cache_path != NULL) {
+		/* Lines are short enough to be appended with a single write. */
+		f = fopen(verified_file_cache_path, "a");
+		if (f != NULL) {
+			digestToHex(file_digest, hex);
+			fprintf(f, "%s %lu\n", hex, (unsigned long) valid_until);
+			fclose(f);
+		}
+	}
+	UNLOCK_VERIFIED_FILE_CACHE();
+
+cleanup:
+	sk_X509_free(certs);
+}
+
+/**/
+
+int GTPublicationsFile_verify(const GTPublicationsFile *publications_file,
+		GTPubFileVerificationInfo **verification_info)
+{
+	int res = GT_UNKNOWN_ERROR;
+	unsigned char file_digest[SHA256_DIGEST_LENGTH];
+
+	if (publications_file == NULL || publications_file->signature == NULL) {
+		res = GT_INVALID_ARGUMENT;
 		goto cleanup;
 	}
 
+	SHA256(publications_file->data, publications_file->data_length,
+			file_digest);
+
+	if (!isVerifiedFile(file_digest)) {
+		res = checkSignature(publications_file);
+		if (res != GT_OK) {
+			goto cleanup;
+		}
+		rememberVerifiedFile(publications_file, file_digest);
+	}
+
 	res = createPubFileVerificationInfo(publications_file, verification_info);
 
 cleanup:
-	BIO_free(bio_in);
 
 	return res;
 }
@@ -950,11 +1579,15 @@ cleanup:
 void GTPublicationsFile_free(GTPublicationsFile *publications_file)
 {
 	if (publications_file != NULL) {
-		if (publications_file->data_owner) {
+		if (publications_file->data_owner == GTPublicationsFile_DataOwned) {
 			GT_free((void*) publications_file->data);
+		} else if (publications_file->data_owner ==
+				GTPublicationsFile_DataMapped) {
+			unmapData(publications_file->data, publications_file->data_length);
 		}
-		GT_free(publications_file->publication_cells);
+		GT_free(publications_file->publication_index);
 		GT_free(publications_file->key_hash_cells);
+		GT_free(publications_file->key_hash_index);
 		GTReferences_free(publications_file->pub_reference);
 		PKCS7_free(publications_file->signature);
 		GT_free(publications_file);
@@ -1014,8 +1647,10 @@ int GTPublicationsFile_getPublishedData(
 		GT_HashDBIndex publication_identifier,
 		GTPublishedData **published_data)
 {
-	unsigned int i;
-	int d;
+	unsigned int lo;
+	unsigned int hi;
+	unsigned int mid;
+	unsigned int cell_index;
 	int rc;
 	const GTPublicationsFile_Cell *cell;
 	GTPublicationsFile_Cell cell_buf;
@@ -1026,44 +1661,29 @@ int GTPublicationsFile_getPublishedData(
 
 	cell = NULL;
 
-	if (publications_file->number_of_publications > 0 &&
-			publication_identifier >=
-			publications_file->first_publication_ident) {
-
-		i = (unsigned int)(publication_identifier -
-				publications_file->first_publication_ident) / 86400;
-
-		if (i >= publications_file->number_of_publications) {
-			i = publications_file->number_of_publications - 1;
+	/* Binary search for the first index entry not less than the
+	 * identifier. */
+	lo = 0;
+	hi = publications_file->number_of_publications;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (getIndexedIdentifier(publications_file, mid, &cell_index) <
+				publication_identifier) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
 		}
+	}
 
-		rc = getPublicationCell(publications_file, i, &cell, &cell_buf);
+	if (lo < publications_file->number_of_publications &&
+			getIndexedIdentifier(publications_file, lo, &cell_index) ==
+			publication_identifier) {
+		/* Malformed cells are reported here, when decoded. */
+		rc = getPublicationCell(publications_file, cell_index,
+				&cell, &cell_buf);
 		if (rc != GT_OK) {
 			return rc;
 		}
-
-		if (cell->publication_identifier != publication_identifier) {
-			/* It is assumed that publications are sorted by their identifiers
-			 * in ascending order to speed things up a little bit. */
-			d = cell->publication_identifier < publication_identifier ? 1 : -1;
-			cell = NULL;
-
-			for (i = i + d;
-					(int) i >= 0 &&
-					i < publications_file->number_of_publications;
-					i += d) {
-				rc = getPublicationCell(publications_file, i, &cell, &cell_buf);
-				if (rc != GT_OK) {
-					return rc;
-				}
-
-				if (cell->publication_identifier == publication_identifier) {
-					break;
-				}
-
-				cell = NULL;
-			}
-		}
 	}
 
 	if (cell == NULL) {
@@ -46,6 +46,20 @@ typedef struct GTPublicationsFile_Cell_st {
 	size_t publication_imprint_offset;
 } GTPublicationsFile_Cell;
 
+/**
+ * This internal structure is an entry of the publication identifier index.
+ */
+typedef struct GTPublicationsFile_IdentIndexEntry_st {
+	/**
+	 * Publication identifier.
+	 */
+	GT_HashDBIndex publication_identifier;
+	/**
+	 * Index of the publication cell.
+	 */
+	unsigned int cell_index;
+} GTPublicationsFile_IdentIndexEntry;
+
 /**
  * This internal structure holds contents of the single key hash cell.
  */
@@ -64,6 +78,18 @@ typedef struct GTPublicationsFile_KeyHashCell_st {
 	size_t key_hash_imprint_offset;
 } GTPublicationsFile_KeyHashCell;
 
+/**
+ * Ownership of the raw contents of the publications file.
+ */
+enum {
+	/** Belongs to the caller and must outlive the structure. */
+	GTPublicationsFile_DataBorrowed = 0,
+	/** Allocated with \c GT_malloc() and freed with the structure. */
+	GTPublicationsFile_DataOwned = 1,
+	/** Read-only mapping of the file, unmapped with the structure. */
+	GTPublicationsFile_DataMapped = 2
+};
+
 /**
  * This internal structure holds contents of the published file.
  */
@@ -79,8 +105,7 @@ struct GTPublicationsFile_st {
 	 */
 	size_t data_length;
 	/**
-	 * Non-zero, if file_data belongs to this structure and must be freed with
-	 * it.
+	 * Ownership of \c data, one of the \c GTPublicationsFile_Data values.
 	 */
 	int data_owner;
 	/* Decoded header fields. */
@@ -95,13 +120,28 @@ struct GTPublicationsFile_st {
 	size_t pub_reference_begin;
 	size_t signature_block_begin;
 	/**
-	 * Array of decoded publication cells.
+	 * Publication cells sorted by identifier, equal identifiers in file
+	 * order; used for lookups by identifier. NULL if the cells are in
+	 * ascending order in the file already. Cells themselves are decoded
+	 * on access.
 	 */
-	GTPublicationsFile_Cell *publication_cells;
+	GTPublicationsFile_IdentIndexEntry *publication_index;
 	/**
 	 * Array of decoded key hash cells.
 	 */
 	GTPublicationsFile_KeyHashCell *key_hash_cells;
+	/**
+	 * Open addressing hash table from key hash imprint to key hash cell:
+	 * each slot holds cell index + 1, or 0 if the slot is empty. The
+	 * number of slots is \c key_hash_index_mask + 1, a power of two.
+	 */
+	unsigned int *key_hash_index;
+	size_t key_hash_index_mask;
+	/**
+	 * Bit \c (1 << alg) is set for every hash algorithm used by the key
+	 * hash imprints.
+	 */
+	unsigned int key_hash_algorithms;
 	/**
 	 * Decoded publication reference.
 	 */
@@ -224,6 +264,24 @@ int GTPublicationsFile_getSigningCert(
 		const GTPublicationsFile *publications_file,
 		unsigned char **cert_der, size_t *cert_der_length);
 
+/**
+ * Finds the key hash cell with the given imprint using the index built
+ * by \c GTPublicationsFile_DERDecode().
+ *
+ * \param publications_file \c (in) - Pointer to publications file.
+ *
+ * \param imprint \c (in) - Key hash imprint (hash algorithm byte followed
+ * by the hash value).
+ *
+ * \param imprint_length \c (in) - Length of the imprint.
+ *
+ * \return index of the first cell with the given imprint, or -1 if there
+ * is no such cell.
+ */
+int GTPublicationsFile_findKeyHash(
+		const GTPublicationsFile *publications_file,
+		const unsigned char *imprint, size_t imprint_length);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,6 +26,7 @@
 #include <openssl/err.h>
 #include <openssl/asn1.h>
 #include <openssl/pkcs7.h>
+#include <openssl/sha.h>
 
 #include "gt_internal.h"
 #include "hashchain.h"
@@ -33,8 +34,11 @@
 #include "asn1_time_get.h"
 
 #ifdef _WIN32
+#include <windows.h>
 #define snprintf _snprintf
-#endif
+#else /* _WIN32 */
+#include <pthread.h>
+#endif /* not _WIN32 */
 
 /**
  * This internal structure represents decoded timestamp. We cannot use PKCS7
@@ -60,6 +64,23 @@ struct GTTimestamp_st {
 	 * sync with the contents of the token.
 	 */
 	GTTimeSignature *time_signature;
+	/**
+	 * Location and history hash chains of the time_signature, parsed once
+	 * for the verification. NULL if a chain is malformed; such a chain is
+	 * re-parsed during verification to report the error.
+	 */
+	GTHashChain *location_chain;
+	GTHashChain *history_chain;
+	/**
+	 * Encodings of the TSTInfo and of the signed attributes, that are
+	 * hashed during verification. The TSTInfo encoding points into the
+	 * token; the signed attributes are encoded once when the signer info
+	 * is extracted.
+	 */
+	const unsigned char *tst_info_der;
+	size_t tst_info_der_length;
+	unsigned char *signed_attrs_der;
+	size_t signed_attrs_der_length;
 };
 
 /**/
@@ -74,6 +95,12 @@ static GTTimestamp* GTTimestamp_new()
 		timestamp->tst_info = NULL;
 		timestamp->signer_info = NULL;
 		timestamp->time_signature = NULL;
+		timestamp->location_chain = NULL;
+		timestamp->history_chain = NULL;
+		timestamp->tst_info_der = NULL;
+		timestamp->tst_info_der_length = 0;
+		timestamp->signed_attrs_der = NULL;
+		timestamp->signed_attrs_der_length = 0;
 	}
 
 	return timestamp;
@@ -87,6 +114,9 @@ void GTTimestamp_free(GTTimestamp *timestamp)
 		PKCS7_free(timestamp->token);
 		GTTSTInfo_free(timestamp->tst_info);
 		GTTimeSignature_free(timestamp->time_signature);
+		GTHashChain_free(timestamp->location_chain);
+		GTHashChain_free(timestamp->history_chain);
+		OPENSSL_free(timestamp->signed_attrs_der);
 		GT_free(timestamp);
 	}
 }
@@ -108,6 +138,8 @@ static int GTTimestamp_updateTSTInfo(GTTimestamp *timestamp)
 
 	GTTSTInfo_free(timestamp->tst_info);
 	timestamp->tst_info = NULL;
+	timestamp->tst_info_der = NULL;
+	timestamp->tst_info_der_length = 0;
 
 	if (!PKCS7_type_is_signed(timestamp->token)) {
 		res = GT_INVALID_FORMAT;
@@ -142,6 +174,12 @@ static int GTTimestamp_updateTSTInfo(GTTimestamp *timestamp)
 		goto cleanup;
 	}
 
+	/* The TSTInfo is hashed as it appears in the token. */
+	timestamp->tst_info_der =
+		ASN1_STRING_data(encoded_tst_info->value.octet_string);
+	timestamp->tst_info_der_length =
+		ASN1_STRING_length(encoded_tst_info->value.octet_string);
+
 	res = GT_OK;
 
 cleanup:
@@ -154,8 +192,10 @@ cleanup:
 static int GTTimestamp_updateTimeSignature(GTTimestamp *timestamp)
 {
 	int res = GT_UNKNOWN_ERROR;
+	int tmp_res;
 	STACK_OF(PKCS7_SIGNER_INFO) *pkcs7_signer_infos;
 	const unsigned char *d2ip;
+	int tmp_der_len;
 
 	/* If OID isn't initialised we don't crash at least unless compiled
 	 * in release mode where asserts are no-op. */
@@ -168,8 +208,15 @@ static int GTTimestamp_updateTimeSignature(GTTimestamp *timestamp)
 	}
 
 	GTTimeSignature_free(timestamp->time_signature);
+	GTHashChain_free(timestamp->location_chain);
+	GTHashChain_free(timestamp->history_chain);
+	OPENSSL_free(timestamp->signed_attrs_der);
 	timestamp->signer_info = NULL;
 	timestamp->time_signature = NULL;
+	timestamp->location_chain = NULL;
+	timestamp->history_chain = NULL;
+	timestamp->signed_attrs_der = NULL;
+	timestamp->signed_attrs_der_length = 0;
 
 	if (!PKCS7_type_is_signed(timestamp->token)) {
 		res = GT_INVALID_FORMAT;
@@ -206,6 +253,43 @@ static int GTTimestamp_updateTimeSignature(GTTimestamp *timestamp)
 		goto cleanup;
 	}
 
+	/* Parse hash chains once, so that verifications need not do it. A
+	 * broken chain is not a decoding error, verification reports it. */
+	tmp_res = GTHashChain_compile(
+			ASN1_STRING_data(timestamp->time_signature->location),
+			ASN1_STRING_length(timestamp->time_signature->location),
+			&timestamp->location_chain);
+	if (tmp_res == GT_OUT_OF_MEMORY) {
+		res = tmp_res;
+		goto cleanup;
+	}
+	tmp_res = GTHashChain_compile(
+			ASN1_STRING_data(timestamp->time_signature->history),
+			ASN1_STRING_length(timestamp->time_signature->history),
+			&timestamp->history_chain);
+	if (tmp_res == GT_OUT_OF_MEMORY) {
+		res = tmp_res;
+		goto cleanup;
+	}
+
+	/* Signed attributes are hashed in their DER encoding (as a SET OF),
+	 * which the decoded signer info does not keep. Encode them once here
+	 * instead of on every verification. If this fails, verification
+	 * reports the error. */
+	ERR_clear_error();
+	tmp_der_len = ASN1_item_i2d(
+			(ASN1_VALUE*) timestamp->signer_info->auth_attr,
+			&timestamp->signed_attrs_der, ASN1_ITEM_rptr(PKCS7_ATTR_SIGN));
+	if (tmp_der_len < 0) {
+		timestamp->signed_attrs_der = NULL;
+		if (GT_isMallocFailure()) {
+			res = GT_OUT_OF_MEMORY;
+			goto cleanup;
+		}
+	} else {
+		timestamp->signed_attrs_der_length = tmp_der_len;
+	}
+
 	res = GT_OK;
 
 cleanup:
@@ -2030,6 +2114,92 @@ cleanup:
 	return res;
 }
 
+/**/
+
+int GTTimestamp_getMetadata(const GTTimestamp *timestamp,
+		GTTimestampMetadata **metadata)
+{
+	int res = GT_UNKNOWN_ERROR;
+	int tmp_res;
+	GTTimestampMetadata *tmp_metadata = NULL;
+	ASN1_OCTET_STRING *history_shape = NULL;
+	GT_HashDBIndex history_identifier;
+	GT_HashDBIndex publication_identifier;
+	unsigned char *location_name = NULL;
+
+	if (timestamp == NULL || timestamp->token == NULL ||
+			timestamp->tst_info == NULL || timestamp->time_signature == NULL ||
+			metadata == NULL) {
+		res = GT_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	tmp_metadata = GT_malloc(sizeof(GTTimestampMetadata));
+	if (tmp_metadata == NULL) {
+		res = GT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+	tmp_metadata->location_name = NULL;
+
+	tmp_res = GTTimestamp_getAlgorithm(timestamp, &tmp_metadata->hash_algorithm);
+	if (tmp_res != GT_OK) {
+		res = tmp_res;
+		goto cleanup;
+	}
+
+	if (!GT_asn1IntegerToUint64(&publication_identifier,
+				(timestamp->time_signature->
+				 publishedData->publicationIdentifier))) {
+		res = GT_INVALID_FORMAT;
+		goto cleanup;
+	}
+	tmp_metadata->publication_identifier = publication_identifier;
+
+	tmp_res = GT_shape(timestamp->time_signature->history, &history_shape);
+	if (tmp_res != GT_OK) {
+		res = tmp_res;
+		goto cleanup;
+	}
+
+	tmp_res = GT_findHistoryIdentifier(
+			(timestamp->time_signature->
+			 publishedData->publicationIdentifier),
+			history_shape, NULL, &history_identifier);
+	if (tmp_res != GT_OK) {
+		res = tmp_res;
+		goto cleanup;
+	}
+	tmp_metadata->registered_time = history_identifier;
+
+	tmp_res = extractLocation(timestamp->time_signature->location,
+			&tmp_metadata->location_id, &location_name);
+	if (tmp_res != GT_OK) {
+		res = tmp_res;
+		goto cleanup;
+	}
+	tmp_metadata->location_name = (char *) location_name;
+
+	*metadata = tmp_metadata;
+	tmp_metadata = NULL;
+	res = GT_OK;
+
+cleanup:
+	GTTimestampMetadata_free(tmp_metadata);
+	ASN1_OCTET_STRING_free(history_shape);
+
+	return res;
+}
+
+/**/
+
+void GTTimestampMetadata_free(GTTimestampMetadata *metadata)
+{
+	if (metadata != NULL) {
+		GT_free(metadata->location_name);
+		GT_free(metadata);
+	}
+}
+
 /* Helper for performing syntactic check of the timestamp. */
 static int checkTimestampSyntax(const GTTimestamp *timestamp)
 {
@@ -2114,23 +2284,69 @@ static int checkTimestampSyntax(const GTTimestamp *timestamp)
 	return GT_OK;
 }
 
-/* Helper for performing of the hash chain check. */
-static int checkHashChain(const GTTimestamp *timestamp)
+/* Helper that applies a hash chain of the timestamp. The chain is normally
+ * already compiled; if compiling it failed, the raw chain is walked to
+ * report the error. The result is written to the buffer given by the caller,
+ * which must be at least GT_HASHCHAIN_MAX_RESULT_LENGTH bytes long and may
+ * be the same as the input. */
+static int applyHashChain(
+		const GTHashChain *compiled, const ASN1_OCTET_STRING *raw,
+		int usedepth, const unsigned char *data, size_t data_length,
+		unsigned char *result, size_t *result_length)
+{
+	int res = GT_UNKNOWN_ERROR;
+	unsigned char *tmp_output = NULL;
+	size_t tmp_output_len;
+
+	if (compiled != NULL) {
+		if (!usedepth && GT_isHashChainCacheEnabled()) {
+			return GTHashChain_calculateCached(
+					compiled, data, data_length, result, result_length);
+		}
+		return GTHashChain_calculateInto(compiled, data, data_length,
+				usedepth, result, result_length);
+	}
+
+	if (usedepth) {
+		res = GT_hashChainCalculate(
+				ASN1_STRING_data((ASN1_OCTET_STRING*) raw),
+				ASN1_STRING_length((ASN1_OCTET_STRING*) raw),
+				data, data_length, &tmp_output, &tmp_output_len);
+	} else {
+		res = GT_hashChainCalculateNoDepth(
+				ASN1_STRING_data((ASN1_OCTET_STRING*) raw),
+				ASN1_STRING_length((ASN1_OCTET_STRING*) raw),
+				data, data_length, &tmp_output, &tmp_output_len);
+	}
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+	if (tmp_output_len > GT_HASHCHAIN_MAX_RESULT_LENGTH) {
+		res = GT_INVALID_LINKING_INFO;
+		goto cleanup;
+	}
+	memcpy(result, tmp_output, tmp_output_len);
+	*result_length = tmp_output_len;
+
+	res = GT_OK;
+
+cleanup:
+	OPENSSL_free(tmp_output);
+
+	return res;
+}
+
+/* First part of the hash chain check: checks the signed attributes and
+ * calculates the input of the location hash chain into \p imprint (at least
+ * EVP_MAX_MD_SIZE + 1 bytes). */
+static int prepareHashChainInput(const GTTimestamp *timestamp,
+		unsigned char *imprint, size_t *imprint_len)
 {
 	int res = GT_UNKNOWN_ERROR;
 	int tmp_res;
 	int alg_server;
 	int alg_client;
-	unsigned char *tmp_der = NULL;
-	int tmp_der_len;
-	ASN1_OCTET_STRING *tmp_imprint = NULL;
 	ASN1_TYPE *attribute_value;
-	ASN1_OCTET_STRING *input = NULL;
-	unsigned char *loc_output = NULL;
-	size_t loc_output_len;
-	unsigned char *hist_output = NULL;
-	size_t hist_output_len;
-	ASN1_OCTET_STRING *output = NULL;
 
 	if (ASN1_STRING_length(timestamp->time_signature->
 				publishedData->publicationImprint) < 1) {
@@ -2160,15 +2376,10 @@ static int checkHashChain(const GTTimestamp *timestamp)
 
 	/* Check that digest value in signed attribute corresponds to the
 	 * DER-encoding of the TSTInfo. */
-	assert(tmp_der == NULL);
-	tmp_der_len = i2d_GTTSTInfo(timestamp->tst_info, &tmp_der);
-	if (tmp_der_len < 0) {
-		res = GT_CRYPTO_FAILURE;
-		goto cleanup;
-	}
-	assert(tmp_imprint == NULL);
-	tmp_res = GT_calculateDataImprint(
-			tmp_der, tmp_der_len, alg_client, &tmp_imprint);
+	assert(timestamp->tst_info_der != NULL);
+	tmp_res = GT_calculateDataImprintInto(
+			timestamp->tst_info_der, timestamp->tst_info_der_length,
+			alg_client, imprint, imprint_len);
 	if (tmp_res != GT_OK) {
 		res = tmp_res;
 		goto cleanup;
@@ -2180,89 +2391,239 @@ static int checkHashChain(const GTTimestamp *timestamp)
 		res = GT_INVALID_FORMAT;
 		goto cleanup;
 	}
-	if ((ASN1_STRING_length(tmp_imprint) !=
+	if ((*imprint_len !=
 				ASN1_STRING_length(attribute_value->value.octet_string) + 1) ||
 			memcmp(
 				ASN1_STRING_data(attribute_value->value.octet_string),
-				ASN1_STRING_data(tmp_imprint) + 1,
-				ASN1_STRING_length(tmp_imprint) - 1) != 0) {
+				imprint + 1, *imprint_len - 1) != 0) {
 		res = GT_WRONG_SIGNED_DATA;
 		goto cleanup;
 	}
 
 	/* Find input for the hash chain calculation. */
-	OPENSSL_free(tmp_der);
-	tmp_der = NULL;
-	tmp_der_len = ASN1_item_i2d(
-			(ASN1_VALUE*) timestamp->signer_info->auth_attr, &tmp_der,
-			ASN1_ITEM_rptr(PKCS7_ATTR_SIGN));
-	if (tmp_der_len < 0) {
+	if (timestamp->signed_attrs_der == NULL) {
 		res = GT_CRYPTO_FAILURE;
 		goto cleanup;
 	}
-	assert(input == NULL);
-	tmp_res =
-		GT_calculateDataImprint(tmp_der, tmp_der_len, alg_client, &input);
+	tmp_res = GT_calculateDataImprintInto(
+			timestamp->signed_attrs_der, timestamp->signed_attrs_der_length,
+			alg_client, imprint, imprint_len);
 	if (tmp_res != GT_OK) {
 		res = tmp_res;
 		goto cleanup;
 	}
 
-	/* Apply location hash chain to the input. */
-	assert(loc_output == NULL);
-	tmp_res = GT_hashChainCalculate(
-			ASN1_STRING_data(timestamp->time_signature->location),
-			ASN1_STRING_length(timestamp->time_signature->location),
-			ASN1_STRING_data(input),
-			ASN1_STRING_length(input),
-			&loc_output, &loc_output_len);
+	res = GT_OK;
+
+cleanup:
+	return res;
+}
+
+/* Last part of the hash chain check: compares the output of the history
+ * hash chain with the published imprint. */
+static int finishHashChainCheck(const GTTimestamp *timestamp,
+		const unsigned char *chain_output, size_t chain_output_len)
+{
+	int tmp_res;
+	unsigned char imprint[EVP_MAX_MD_SIZE + 1];
+	size_t imprint_len;
+	const ASN1_OCTET_STRING *publication_imprint =
+		timestamp->time_signature->publishedData->publicationImprint;
+
+	/* Perform final hashing step. Algorithm was checked when preparing. */
+	tmp_res = GT_calculateDataImprintInto(chain_output, chain_output_len,
+			ASN1_STRING_data((ASN1_OCTET_STRING*) publication_imprint)[0],
+			imprint, &imprint_len);
 	if (tmp_res != GT_OK) {
-		res = tmp_res;
-		goto cleanup;
+		return tmp_res;
+	}
+
+	/* Compare result with the expected value. */
+	if (imprint_len != ASN1_STRING_length(
+				(ASN1_OCTET_STRING*) publication_imprint) ||
+			memcmp(imprint, ASN1_STRING_data(
+					(ASN1_OCTET_STRING*) publication_imprint),
+				imprint_len) != 0) {
+		return GT_INVALID_AGGREGATION;
+	}
+
+	return GT_OK;
+}
+
+/* Helper for performing of the hash chain check. */
+static int checkHashChain(const GTTimestamp *timestamp)
+{
+	int res = GT_UNKNOWN_ERROR;
+	/* The input imprint and step results are kept in this buffer, so that
+	 * the chain calculation does not allocate memory. */
+	unsigned char chain_output[GT_HASHCHAIN_MAX_RESULT_LENGTH];
+	size_t chain_output_len;
+
+	res = prepareHashChainInput(timestamp, chain_output, &chain_output_len);
+	if (res != GT_OK) {
+		return res;
+	}
+
+	/* Apply location hash chain to the input. */
+	res = applyHashChain(timestamp->location_chain,
+			timestamp->time_signature->location, 1,
+			chain_output, chain_output_len, chain_output, &chain_output_len);
+	if (res != GT_OK) {
+		return res;
 	}
 
 	/* Apply history hash chain to the input. */
-	assert(hist_output == NULL);
-	tmp_res = GT_hashChainCalculateNoDepth(
-			ASN1_STRING_data(timestamp->time_signature->history),
-			ASN1_STRING_length(timestamp->time_signature->history),
-			loc_output, loc_output_len,
-			&hist_output, &hist_output_len);
-	if (tmp_res != GT_OK) {
-		res = tmp_res;
-		goto cleanup;
+	res = applyHashChain(timestamp->history_chain,
+			timestamp->time_signature->history, 0,
+			chain_output, chain_output_len, chain_output, &chain_output_len);
+	if (res != GT_OK) {
+		return res;
 	}
 
-	/* Perform final hashing step. */
-	assert(output == NULL);
-	tmp_res = GT_calculateDataImprint(
-			hist_output, hist_output_len, alg_server, &output);
-	if (tmp_res != GT_OK) {
-		res = tmp_res;
-		goto cleanup;
+	return finishHashChainCheck(timestamp, chain_output, chain_output_len);
+}
+
+/*
+ * Cache of public keys for checking signatures of unextended timestamps.
+ * Only a handful of gateway signing keys exist, so the decoded keys are
+ * kept in a small table keyed by the SHA-256 digest of the subject public
+ * key instead of being decoded from the certificate for every check.
+ * The cached RSA keys also keep their Montgomery contexts, which OpenSSL
+ * sets up on the first use of a key.
+ */
+
+#define PUBLIC_KEY_CACHE_SIZE 16
+
+typedef struct {
+	unsigned char key_digest[SHA256_DIGEST_LENGTH];
+	EVP_PKEY *pubkey;
+} PublicKeyCacheEntry;
+
+static PublicKeyCacheEntry public_key_cache[PUBLIC_KEY_CACHE_SIZE];
+/* Slot to be replaced next. */
+static int public_key_cache_next = 0;
+
+#ifdef _WIN32
+static HANDLE public_key_cache_lock = NULL;
+#define LOCK_PUBLIC_KEY_CACHE() \
+	WaitForSingleObject(public_key_cache_lock, INFINITE)
+#define UNLOCK_PUBLIC_KEY_CACHE() ReleaseMutex(public_key_cache_lock)
+#else /* _WIN32 */
+static pthread_mutex_t public_key_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_PUBLIC_KEY_CACHE() pthread_mutex_lock(&public_key_cache_lock)
+#define UNLOCK_PUBLIC_KEY_CACHE() pthread_mutex_unlock(&public_key_cache_lock)
+#endif /* not _WIN32 */
+
+/**/
+
+int GT_initPublicKeyCache(void)
+{
+#ifdef _WIN32
+	if (public_key_cache_lock == NULL) {
+		public_key_cache_lock = CreateMutex(NULL, FALSE, NULL);
+		if (public_key_cache_lock == NULL) {
+			return GT_OUT_OF_MEMORY;
+		}
 	}
+#endif /* _WIN32 */
 
-	/* Compare result with the expected value. */
-	if (ASN1_OCTET_STRING_cmp(output,
-				(timestamp->time_signature->
-				 publishedData->publicationImprint)) != 0) {
-		res = GT_INVALID_AGGREGATION;
-		goto cleanup;
+	return GT_OK;
+}
+
+/**/
+
+void GT_finalizePublicKeyCache(void)
+{
+	int i;
+
+	for (i = 0; i < PUBLIC_KEY_CACHE_SIZE; ++i) {
+		EVP_PKEY_free(public_key_cache[i].pubkey);
+		public_key_cache[i].pubkey = NULL;
 	}
+	public_key_cache_next = 0;
+#ifdef _WIN32
+	if (public_key_cache_lock != NULL) {
+		CloseHandle(public_key_cache_lock);
+		public_key_cache_lock = NULL;
+	}
+#endif /* _WIN32 */
+}
 
-	res = GT_OK;
+/**/
 
-cleanup:
-	OPENSSL_free(tmp_der);
-	ASN1_OCTET_STRING_free(tmp_imprint);
-	ASN1_OCTET_STRING_free(input);
-	OPENSSL_free(loc_output);
-	OPENSSL_free(hist_output);
-	ASN1_OCTET_STRING_free(output);
+/* Looks up the key with the given digest; the lock must be held. Returns
+ * a new reference to the key or NULL if not found. */
+static EVP_PKEY *findCachedPublicKey(const unsigned char *key_digest)
+{
+	int i;
 
-	return res;
+	for (i = 0; i < PUBLIC_KEY_CACHE_SIZE; ++i) {
+		if (public_key_cache[i].pubkey != NULL &&
+				memcmp(public_key_cache[i].key_digest, key_digest,
+					SHA256_DIGEST_LENGTH) == 0) {
+			CRYPTO_add(&public_key_cache[i].pubkey->references, 1,
+					CRYPTO_LOCK_EVP_PKEY);
+			return public_key_cache[i].pubkey;
+		}
+	}
+
+	return NULL;
 }
 
+/**/
+
+/* Returns the public key of the certificate, to be freed with
+ * EVP_PKEY_free(), or NULL on failure. */
+static EVP_PKEY *getPublicKey(const X509 *certificate)
+{
+	unsigned char key_digest[SHA256_DIGEST_LENGTH];
+	unsigned int key_digest_len;
+	EVP_PKEY *pubkey;
+	EVP_PKEY *cached;
+
+	if (!X509_pubkey_digest(certificate, EVP_sha256(),
+				key_digest, &key_digest_len)) {
+		return NULL;
+	}
+
+	LOCK_PUBLIC_KEY_CACHE();
+	pubkey = findCachedPublicKey(key_digest);
+	UNLOCK_PUBLIC_KEY_CACHE();
+	if (pubkey != NULL) {
+		return pubkey;
+	}
+
+	/* Decode outside of the lock. */
+	pubkey = X509_get_pubkey((X509*) certificate);
+	if (pubkey == NULL) {
+		return NULL;
+	}
+
+	LOCK_PUBLIC_KEY_CACHE();
+	/* Another thread may have added the same key meanwhile. */
+	cached = findCachedPublicKey(key_digest);
+	if (cached == NULL) {
+		PublicKeyCacheEntry *entry = &public_key_cache[public_key_cache_next];
+
+		public_key_cache_next =
+			(public_key_cache_next + 1) % PUBLIC_KEY_CACHE_SIZE;
+		EVP_PKEY_free(entry->pubkey);
+		memcpy(entry->key_digest, key_digest, SHA256_DIGEST_LENGTH);
+		entry->pubkey = pubkey;
+		CRYPTO_add(&pubkey->references, 1, CRYPTO_LOCK_EVP_PKEY);
+	}
+	UNLOCK_PUBLIC_KEY_CACHE();
+
+	if (cached != NULL) {
+		EVP_PKEY_free(pubkey);
+		pubkey = cached;
+	}
+
+	return pubkey;
+}
+
+/**/
+
 /* Helper for performing of the public key signature check. */
 static int checkPublicKeySignature(
 		const GTTimestamp *timestamp, const X509 *certificate)
@@ -2297,7 +2658,7 @@ static int checkPublicKeySignature(
 	}
 
 	/* Extract public key from the certificate. */
-	pubkey = X509_get_pubkey((X509*) certificate);
+	pubkey = getPublicKey(certificate);
 	if (pubkey == NULL) {
 		res = GT_CRYPTO_FAILURE;
 		goto cleanup;
@@ -2357,21 +2718,25 @@ cleanup:
 
 /**/
 
-int GTTimestamp_verify(const GTTimestamp *timestamp,
-		int parse_data, GTVerificationInfo **verification_info)
+/* Helper that checks if the timestamp is usable for verification. */
+static int isVerifiable(const GTTimestamp *timestamp)
+{
+	return timestamp != NULL && timestamp->token != NULL &&
+		timestamp->tst_info != NULL && timestamp->time_signature != NULL;
+}
+
+/* Helper that performs the verification, given the result of the hash
+ * chain check (calculated separately, so that a batch of timestamps can
+ * share the chain calculation). */
+static int verifyWithHashChainResult(const GTTimestamp *timestamp,
+		int parse_data, int hash_chain_res,
+		GTVerificationInfo **verification_info)
 {
 	int res = GT_UNKNOWN_ERROR;
 	int tmp_res;
 	const X509 *certificate = NULL;
 	GTVerificationInfo *tmp_info = NULL;
 
-	if (timestamp == NULL || timestamp->token == NULL ||
-			timestamp->tst_info == NULL || timestamp->time_signature == NULL ||
-			verification_info == NULL) {
-		res = GT_INVALID_ARGUMENT;
-		goto cleanup;
-	}
-
 	/* Create verification info structure with most fields already set to their
 	 * final values. */
 	tmp_res = createVerificationInfo(timestamp, &tmp_info, parse_data);
@@ -2393,7 +2758,7 @@ int GTTimestamp_verify(const GTTimestamp *timestamp,
 	}
 
 	/* Hash Chain Check. */
-	tmp_res = checkHashChain(timestamp);
+	tmp_res = hash_chain_res;
 	switch (tmp_res) {
 	case GT_OK:
 		break;
@@ -2444,6 +2809,138 @@ cleanup:
 
 /**/
 
+int GTTimestamp_verify(const GTTimestamp *timestamp,
+		int parse_data, GTVerificationInfo **verification_info)
+{
+	if (!isVerifiable(timestamp) || verification_info == NULL) {
+		return GT_INVALID_ARGUMENT;
+	}
+
+	return verifyWithHashChainResult(timestamp, parse_data,
+			checkHashChain(timestamp), verification_info);
+}
+
+/**/
+
+int GTTimestamp_verifyBatch(const GTTimestamp *const *timestamps,
+		int count, int parse_data, GTVerificationInfo **verification_infos,
+		int *results)
+{
+	int res = GT_UNKNOWN_ERROR;
+	int i;
+	unsigned char *buffer_data = NULL;
+	unsigned char **buffers = NULL;
+	size_t *lengths = NULL;
+	int *chain_results = NULL;
+	const GTHashChain **chains = NULL;
+	int use_cache;
+
+	if (count < 0 || (count > 0 && (timestamps == NULL ||
+					verification_infos == NULL || results == NULL))) {
+		res = GT_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	for (i = 0; i < count; ++i) {
+		verification_infos[i] = NULL;
+		results[i] = GT_UNKNOWN_ERROR;
+	}
+	if (count == 0) {
+		res = GT_OK;
+		goto cleanup;
+	}
+
+	buffer_data = GT_malloc(count * GT_HASHCHAIN_MAX_RESULT_LENGTH);
+	buffers = GT_malloc(count * sizeof(*buffers));
+	lengths = GT_malloc(count * sizeof(*lengths));
+	chain_results = GT_malloc(count * sizeof(*chain_results));
+	chains = GT_malloc(count * sizeof(*chains));
+	if (buffer_data == NULL || buffers == NULL || lengths == NULL ||
+			chain_results == NULL || chains == NULL) {
+		res = GT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	/* Calculate the inputs of the location hash chains. */
+	for (i = 0; i < count; ++i) {
+		buffers[i] = buffer_data + i * GT_HASHCHAIN_MAX_RESULT_LENGTH;
+		if (!isVerifiable(timestamps[i])) {
+			chain_results[i] = GT_INVALID_ARGUMENT;
+			continue;
+		}
+		chain_results[i] = prepareHashChainInput(
+				timestamps[i], buffers[i], &lengths[i]);
+	}
+
+	/* Apply location hash chains. Chains that could not be compiled are
+	 * walked one by one to report the error. */
+	for (i = 0; i < count; ++i) {
+		chains[i] = chain_results[i] == GT_OK ?
+			timestamps[i]->location_chain : NULL;
+	}
+	res = GTHashChain_calculateBatch(
+			chains, count, 1, buffers, lengths, chain_results);
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+	for (i = 0; i < count; ++i) {
+		if (chain_results[i] == GT_OK && chains[i] == NULL) {
+			chain_results[i] = applyHashChain(NULL,
+					timestamps[i]->time_signature->location, 1,
+					buffers[i], lengths[i], buffers[i], &lengths[i]);
+		}
+	}
+
+	/* Apply history hash chains. With the history cache enabled the
+	 * chains are applied one by one, since most of them are found in the
+	 * cache. */
+	use_cache = GT_isHashChainCacheEnabled();
+	for (i = 0; i < count; ++i) {
+		chains[i] = chain_results[i] == GT_OK && !use_cache ?
+			timestamps[i]->history_chain : NULL;
+	}
+	res = GTHashChain_calculateBatch(
+			chains, count, 0, buffers, lengths, chain_results);
+	if (res != GT_OK) {
+		goto cleanup;
+	}
+	for (i = 0; i < count; ++i) {
+		if (chain_results[i] == GT_OK && chains[i] == NULL) {
+			chain_results[i] = applyHashChain(timestamps[i]->history_chain,
+					timestamps[i]->time_signature->history, 0,
+					buffers[i], lengths[i], buffers[i], &lengths[i]);
+		}
+	}
+
+	/* Finish the hash chain checks and the rest of the verification. */
+	for (i = 0; i < count; ++i) {
+		if (chain_results[i] == GT_INVALID_ARGUMENT &&
+				!isVerifiable(timestamps[i])) {
+			results[i] = GT_INVALID_ARGUMENT;
+			continue;
+		}
+		if (chain_results[i] == GT_OK) {
+			chain_results[i] = finishHashChainCheck(
+					timestamps[i], buffers[i], lengths[i]);
+		}
+		results[i] = verifyWithHashChainResult(timestamps[i], parse_data,
+				chain_results[i], &verification_infos[i]);
+	}
+
+	res = GT_OK;
+
+cleanup:
+	GT_free(buffer_data);
+	GT_free(buffers);
+	GT_free(lengths);
+	GT_free(chain_results);
+	GT_free(chains);
+
+	return res;
+}
+
+/**/
+
 int GTTimestamp_checkDocumentHash(
 		const GTTimestamp *timestamp, const GTDataHash *data_hash)
 {
@@ -2552,9 +3049,9 @@ int GTTimestamp_checkPublicKey(
 	const X509 *certificate = NULL;
 	unsigned char *key_der = NULL;
 	int key_der_len;
-	unsigned int i;
-	const unsigned char *cur_imprint;
-	size_t cur_imprint_size;
+	int alg;
+	int cell_index;
+	int found = -1;
 	ASN1_OCTET_STRING *key_hash = NULL;
 	const GTPublicationsFile_KeyHashCell *keycell;
 
@@ -2577,52 +3074,44 @@ int GTTimestamp_checkPublicKey(
 		goto cleanup;
 	}
 
-	res = GT_KEY_NOT_PUBLISHED;
-
-	for (i = 0; i < publications_file->number_of_key_hashes; ++i) {
-		tmp_res = GTPublicationsFile_getKeyHash(
-				publications_file, i, &cur_imprint, &cur_imprint_size);
-		if (tmp_res != GT_OK) {
-			res = tmp_res;
-			goto cleanup;
+	/* The key is hashed once per algorithm used in the publications file
+	 * and looked up in its index. Of several matching cells, the first one
+	 * in the file is used. */
+	for (alg = 0; alg <= GT_HASHALG_SHA512; ++alg) {
+		if ((publications_file->key_hash_algorithms & (1u << alg)) == 0) {
+			continue;
 		}
 
-		assert(cur_imprint_size > 0);
-
-		if (key_hash == NULL || key_hash->data[0] != cur_imprint[0]) {
-			ASN1_OCTET_STRING_free(key_hash);
-			key_hash = NULL;
-
-			tmp_res = GT_calculateDataImprint(
-					key_der, key_der_len, cur_imprint[0], &key_hash);
-			if (tmp_res != GT_OK) {
-				/* If we failed to hash the key - we just skip the
-				 * current hash. */
-				continue;
-			}
+		tmp_res = GT_calculateDataImprint(key_der, key_der_len, alg, &key_hash);
+		if (tmp_res != GT_OK) {
+			/* If we failed to hash the key - we just skip the
+			 * current algorithm. */
+			continue;
 		}
 
-		assert(key_hash != NULL);
+		cell_index = GTPublicationsFile_findKeyHash(
+				publications_file, key_hash->data, key_hash->length);
+		ASN1_OCTET_STRING_free(key_hash);
+		key_hash = NULL;
 
-		if (key_hash->length != cur_imprint_size) {
-			/* Should never happen unless publications file has an incorrect
-			 * format. Just skip this hash. */
-			continue;
+		if (cell_index >= 0 && (found < 0 || cell_index < found)) {
+			found = cell_index;
 		}
+	}
 
-		if (memcmp(key_hash->data, cur_imprint, cur_imprint_size) == 0) {
-			keycell = publications_file->key_hash_cells + i;
-
-			if (keycell->key_publication_time > history_identifier) {
-				res = GT_CERT_TICKET_TOO_OLD;
-				goto cleanup;
-			}
+	if (found < 0) {
+		res = GT_KEY_NOT_PUBLISHED;
+		goto cleanup;
+	}
 
-			res = GT_OK;
-			break;
-		}
+	keycell = publications_file->key_hash_cells + found;
+	if (keycell->key_publication_time > history_identifier) {
+		res = GT_CERT_TICKET_TOO_OLD;
+		goto cleanup;
 	}
 
+	res = GT_OK;
+
 cleanup:
 	OPENSSL_free(key_der);
 	ASN1_OCTET_STRING_free(key_hash);
@@ -37,6 +37,12 @@
  */
 X509_STORE *GT_truststore = NULL;
 
+/*
+ * Incremented whenever the trust store is created or released, so that
+ * the results of earlier verifications can be told apart.
+ */
+unsigned int GT_truststore_generation = 0;
+
 int GTTruststore_init(int set_defaults)
 {
 	int res = GT_UNKNOWN_ERROR;
@@ -52,6 +58,7 @@ int GTTruststore_init(int set_defaults)
 		res = GT_OUT_OF_MEMORY;
 		goto cleanup;
 	}
+	++GT_truststore_generation;
 
 	if (set_defaults) {
 		/* Set system default paths. */
@@ -94,6 +101,7 @@ void GTTruststore_finalize(void)
 	if (GT_truststore != NULL) {
 		X509_STORE_free(GT_truststore);
 		GT_truststore = NULL;
+		++GT_truststore_generation;
 	}
 }
 
@@ -26,7 +26,13 @@
 #include <assert.h>
 #include <memory.h>
 
-#define MAX_STEP_RESULT_LEN (2 * EVP_MAX_MD_SIZE + 3)
+#ifdef _WIN32
+#include <windows.h>
+#else /* _WIN32 */
+#include <pthread.h>
+#endif /* not _WIN32 */
+
+#define MAX_STEP_RESULT_LEN GT_HASHCHAIN_MAX_RESULT_LENGTH
 
 struct hash_chain_constructor_impl {
 	unsigned char *hash_chain;
@@ -54,6 +60,431 @@ typedef struct {
 	unsigned char hash[EVP_MAX_MD_SIZE];
 } HCDigest;
 
+/**
+ * Digest contexts of a thread, one per hash algorithm. A context is set up
+ * for its algorithm once and later only re-initialised, so that repeated
+ * digest calculations reuse its state instead of allocating it every time.
+ */
+typedef struct {
+	EVP_MD_CTX md_ctx[GT_HASHALG_SHA512 + 1];
+	int md_ctx_initialized[GT_HASHALG_SHA512 + 1];
+} DigestContexts;
+
+#ifdef _WIN32
+static DWORD digest_contexts_key = TLS_OUT_OF_INDEXES;
+#else /* _WIN32 */
+static pthread_key_t digest_contexts_key;
+static int digest_contexts_key_created = 0;
+#endif /* not _WIN32 */
+
+/**/
+
+static void DigestContexts_free(void *p)
+{
+	DigestContexts *contexts = p;
+	int i;
+
+	if (contexts != NULL) {
+		for (i = 0; i <= GT_HASHALG_SHA512; ++i) {
+			if (contexts->md_ctx_initialized[i]) {
+				EVP_MD_CTX_cleanup(&contexts->md_ctx[i]);
+			}
+		}
+		OPENSSL_free(contexts);
+	}
+}
+
+/**/
+
+static void selectMultiDigest(void);
+
+int GT_initDigestContexts(void)
+{
+	selectMultiDigest();
+
+#ifdef _WIN32
+	if (digest_contexts_key == TLS_OUT_OF_INDEXES) {
+		digest_contexts_key = TlsAlloc();
+		if (digest_contexts_key == TLS_OUT_OF_INDEXES) {
+			return GT_OUT_OF_MEMORY;
+		}
+	}
+#else /* _WIN32 */
+	if (!digest_contexts_key_created) {
+		/* Contexts of other threads are freed when the threads exit. */
+		if (pthread_key_create(&digest_contexts_key, DigestContexts_free) != 0) {
+			return GT_OUT_OF_MEMORY;
+		}
+		digest_contexts_key_created = 1;
+	}
+#endif /* not _WIN32 */
+
+	return GT_OK;
+}
+
+/**/
+
+void GT_finalizeDigestContexts(void)
+{
+#ifdef _WIN32
+	if (digest_contexts_key != TLS_OUT_OF_INDEXES) {
+		/* There are no TLS destructors on Windows, so only contexts of the
+		 * calling thread can be freed. */
+		DigestContexts_free(TlsGetValue(digest_contexts_key));
+		TlsFree(digest_contexts_key);
+		digest_contexts_key = TLS_OUT_OF_INDEXES;
+	}
+#else /* _WIN32 */
+	if (digest_contexts_key_created) {
+		DigestContexts_free(pthread_getspecific(digest_contexts_key));
+		pthread_key_delete(digest_contexts_key);
+		digest_contexts_key_created = 0;
+	}
+#endif /* not _WIN32 */
+}
+
+/**
+ * \return Returns digest context of the calling thread that is set up for
+ * the given hash algorithm, or NULL if it can not be created.
+ */
+static EVP_MD_CTX *getDigestContext(int hash_alg, const EVP_MD *evp_md)
+{
+	DigestContexts *contexts;
+	int stored;
+
+	hash_alg = GT_fixHashAlgorithm(hash_alg);
+	if (hash_alg < 0 || hash_alg > GT_HASHALG_SHA512) {
+		return NULL;
+	}
+
+#ifdef _WIN32
+	if (digest_contexts_key == TLS_OUT_OF_INDEXES) {
+		return NULL;
+	}
+	contexts = TlsGetValue(digest_contexts_key);
+#else /* _WIN32 */
+	if (!digest_contexts_key_created) {
+		return NULL;
+	}
+	contexts = pthread_getspecific(digest_contexts_key);
+#endif /* not _WIN32 */
+
+	if (contexts == NULL) {
+		contexts = OPENSSL_malloc(sizeof(DigestContexts));
+		if (contexts == NULL) {
+			return NULL;
+		}
+		memset(contexts, 0, sizeof(DigestContexts));
+#ifdef _WIN32
+		stored = TlsSetValue(digest_contexts_key, contexts);
+#else /* _WIN32 */
+		stored = (pthread_setspecific(digest_contexts_key, contexts) == 0);
+#endif /* not _WIN32 */
+		if (!stored) {
+			OPENSSL_free(contexts);
+			return NULL;
+		}
+	}
+
+	if (!contexts->md_ctx_initialized[hash_alg]) {
+		EVP_MD_CTX_init(&contexts->md_ctx[hash_alg]);
+		if (!EVP_DigestInit_ex(&contexts->md_ctx[hash_alg], evp_md, NULL)) {
+			/* Not marked, so that the next call tries again instead of
+			 * using a context without a digest. */
+			EVP_MD_CTX_cleanup(&contexts->md_ctx[hash_alg]);
+			return NULL;
+		}
+		contexts->md_ctx_initialized[hash_alg] = 1;
+	}
+
+	return &contexts->md_ctx[hash_alg];
+}
+
+/**
+ * Calculates digest with the context of the calling thread. Falls back to
+ * a temporary context if the thread has none.
+ */
+static void calculateDigestMD(const unsigned char *data, size_t data_len,
+		unsigned char *result, int hash_alg, const EVP_MD *evp_md)
+{
+	EVP_MD_CTX *md_ctx;
+
+	md_ctx = getDigestContext(hash_alg, evp_md);
+	if (md_ctx == NULL) {
+		EVP_Digest(data, data_len, result, NULL, evp_md, NULL);
+		return;
+	}
+
+	/* Re-initialise with the digest already set up in the context. */
+	EVP_DigestInit_ex(md_ctx, NULL, NULL);
+	EVP_DigestUpdate(md_ctx, data, data_len);
+	EVP_DigestFinal_ex(md_ctx, result, NULL);
+}
+
+/**
+ * Calculates digests of \p count independent inputs with the same hash
+ * algorithm. Used by the batch hash chain calculation, which has one input
+ * per chain at every step.
+ */
+typedef void (*MultiDigestFunc)(int count, const unsigned char *const *data,
+		const size_t *data_len, unsigned char *const *result,
+		int hash_alg, const EVP_MD *evp_md);
+
+static void multiDigestScalar(int count, const unsigned char *const *data,
+		const size_t *data_len, unsigned char *const *result,
+		int hash_alg, const EVP_MD *evp_md)
+{
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		calculateDigestMD(data[i], data_len[i], result[i], hash_alg, evp_md);
+	}
+}
+
+/*
+ * Multi-buffer SHA-256: eight inputs are hashed in parallel, one in every
+ * 32-bit lane of the AVX2 registers. Only built with compilers that support
+ * AVX2 intrinsics in functions with a target attribute, and only used on
+ * CPUs that have AVX2 but no SHA extensions (with those, OpenSSL is faster
+ * on a single input).
+ */
+#if defined(__x86_64__)
+#if defined(__clang__)
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_cpu_supports)
+#define GT_HAVE_SHA256_AVX2
+#endif
+#endif
+#elif defined(__GNUC__) && \
+	(__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define GT_HAVE_SHA256_AVX2
+#endif
+#endif /* __x86_64__ */
+
+#ifdef GT_HAVE_SHA256_AVX2
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHA256_LANES 8
+/* Step inputs are at most GT_HASHCHAIN_MAX_RESULT_LENGTH bytes, that is
+ * three blocks with padding. Longer inputs are hashed with OpenSSL. */
+#define SHA256_MAX_BLOCKS 4
+
+static const unsigned int sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const unsigned int sha256_h0[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#define ROTR(x, n) _mm256_or_si256( \
+		_mm256_srli_epi32((x), (n)), _mm256_slli_epi32((x), 32 - (n)))
+#define XOR3(a, b, c) _mm256_xor_si256(_mm256_xor_si256((a), (b)), (c))
+
+/** Hashes up to eight inputs of at most SHA256_MAX_BLOCKS blocks. */
+__attribute__((target("avx2")))
+static void sha256Lanes(int count, const unsigned char *const *data,
+		const size_t *data_len, unsigned char *const *result)
+{
+	unsigned char padded[SHA256_LANES][SHA256_MAX_BLOCKS * 64];
+	int blocks[SHA256_LANES];
+	unsigned int w_in[16][SHA256_LANES];
+	unsigned int state_out[8][SHA256_LANES];
+	__m256i state[8], w[16], v[8], t1, t2;
+	int max_blocks = 0;
+	int lane, b, i, j;
+	size_t bits;
+
+	/* Pad every input as SHA-256 does. */
+	for (lane = 0; lane < count; ++lane) {
+		blocks[lane] = (int) ((data_len[lane] + 9 + 63) / 64);
+		memset(padded[lane], 0, blocks[lane] * 64);
+		memcpy(padded[lane], data[lane], data_len[lane]);
+		padded[lane][data_len[lane]] = 0x80;
+		bits = data_len[lane] * 8;
+		for (i = 0; i < 8; ++i) {
+			padded[lane][blocks[lane] * 64 - 1 - i] =
+				(unsigned char) (bits >> (8 * i));
+		}
+		if (blocks[lane] > max_blocks) {
+			max_blocks = blocks[lane];
+		}
+	}
+	for (; lane < SHA256_LANES; ++lane) {
+		blocks[lane] = 0;
+	}
+
+	for (i = 0; i < 8; ++i) {
+		state[i] = _mm256_set1_epi32((int) sha256_h0[i]);
+	}
+
+	for (b = 0; b < max_blocks; ++b) {
+		/* Transpose big-endian message words into lanes. */
+		for (lane = 0; lane < SHA256_LANES; ++lane) {
+			for (i = 0; i < 16; ++i) {
+				if (b < blocks[lane]) {
+					const unsigned char *p = padded[lane] + b * 64 + i * 4;
+					w_in[i][lane] = ((unsigned int) p[0] << 24) |
+						((unsigned int) p[1] << 16) |
+						((unsigned int) p[2] << 8) | p[3];
+				} else {
+					w_in[i][lane] = 0;
+				}
+			}
+		}
+		for (i = 0; i < 16; ++i) {
+			w[i] = _mm256_loadu_si256((const __m256i *) w_in[i]);
+		}
+		for (i = 0; i < 8; ++i) {
+			v[i] = state[i];
+		}
+
+		for (j = 0; j < 64; ++j) {
+			if (j >= 16) {
+				__m256i w15 = w[(j - 15) & 15], w2 = w[(j - 2) & 15];
+				w[j & 15] = _mm256_add_epi32(
+						_mm256_add_epi32(w[j & 15], w[(j - 7) & 15]),
+						_mm256_add_epi32(
+							XOR3(ROTR(w15, 7), ROTR(w15, 18),
+								_mm256_srli_epi32(w15, 3)),
+							XOR3(ROTR(w2, 17), ROTR(w2, 19),
+								_mm256_srli_epi32(w2, 10))));
+			}
+			t1 = _mm256_add_epi32(
+					_mm256_add_epi32(v[7],
+						XOR3(ROTR(v[4], 6), ROTR(v[4], 11), ROTR(v[4], 25))),
+					_mm256_add_epi32(
+						_mm256_xor_si256(_mm256_and_si256(v[4], v[5]),
+							_mm256_andnot_si256(v[4], v[6])),
+						_mm256_add_epi32(
+							_mm256_set1_epi32((int) sha256_k[j]), w[j & 15])));
+			t2 = _mm256_add_epi32(
+					XOR3(ROTR(v[0], 2), ROTR(v[0], 13), ROTR(v[0], 22)),
+					XOR3(_mm256_and_si256(v[0], v[1]),
+						_mm256_and_si256(v[0], v[2]),
+						_mm256_and_si256(v[1], v[2])));
+			v[7] = v[6];
+			v[6] = v[5];
+			v[5] = v[4];
+			v[4] = _mm256_add_epi32(v[3], t1);
+			v[3] = v[2];
+			v[2] = v[1];
+			v[1] = v[0];
+			v[0] = _mm256_add_epi32(t1, t2);
+		}
+
+		for (i = 0; i < 8; ++i) {
+			state[i] = _mm256_add_epi32(state[i], v[i]);
+		}
+
+		/* Lanes whose input ends with this block are done. */
+		for (i = 0; i < 8; ++i) {
+			_mm256_storeu_si256((__m256i *) state_out[i], state[i]);
+		}
+		for (lane = 0; lane < count; ++lane) {
+			if (blocks[lane] == b + 1) {
+				for (i = 0; i < 8; ++i) {
+					result[lane][4 * i] = (unsigned char) (state_out[i][lane] >> 24);
+					result[lane][4 * i + 1] = (unsigned char) (state_out[i][lane] >> 16);
+					result[lane][4 * i + 2] = (unsigned char) (state_out[i][lane] >> 8);
+					result[lane][4 * i + 3] = (unsigned char) state_out[i][lane];
+				}
+			}
+		}
+	}
+}
+
+#undef ROTR
+#undef XOR3
+
+static void multiDigestSHA256AVX2(int count, const unsigned char *const *data,
+		const size_t *data_len, unsigned char *const *result,
+		int hash_alg, const EVP_MD *evp_md)
+{
+	const unsigned char *lane_data[SHA256_LANES];
+	size_t lane_len[SHA256_LANES];
+	unsigned char *lane_result[SHA256_LANES];
+	int lanes = 0;
+	int i;
+
+	if (GT_fixHashAlgorithm(hash_alg) != GT_HASHALG_SHA256) {
+		multiDigestScalar(count, data, data_len, result, hash_alg, evp_md);
+		return;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (data_len[i] + 9 > SHA256_MAX_BLOCKS * 64) {
+			calculateDigestMD(data[i], data_len[i], result[i], hash_alg, evp_md);
+			continue;
+		}
+		lane_data[lanes] = data[i];
+		lane_len[lanes] = data_len[i];
+		lane_result[lanes] = result[i];
+		if (++lanes == SHA256_LANES) {
+			sha256Lanes(lanes, lane_data, lane_len, lane_result);
+			lanes = 0;
+		}
+	}
+	/* A single input is faster to hash without the lanes. */
+	if (lanes == 1) {
+		calculateDigestMD(lane_data[0], lane_len[0], lane_result[0],
+				hash_alg, evp_md);
+	} else if (lanes > 1) {
+		sha256Lanes(lanes, lane_data, lane_len, lane_result);
+	}
+}
+
+static int cpuHasSHA256AVX2(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__builtin_cpu_supports("avx2")) {
+		return 0;
+	}
+	/* SHA extensions are bit 29 of EBX in leaf 7. */
+	if (__get_cpuid_max(0, NULL) >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		if (ebx & (1u << 29)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+#endif /* GT_HAVE_SHA256_AVX2 */
+
+/* Selected by selectMultiDigest() according to the CPU features. */
+static MultiDigestFunc multi_digest = multiDigestScalar;
+
+static void selectMultiDigest(void)
+{
+	multi_digest = multiDigestScalar;
+#ifdef GT_HAVE_SHA256_AVX2
+	if (cpuHasSHA256AVX2()) {
+		multi_digest = multiDigestSHA256AVX2;
+	}
+#endif /* GT_HAVE_SHA256_AVX2 */
+}
+
 /**/
 
 int GT_fixHashAlgorithm(int hash_id)
@@ -102,9 +533,7 @@ size_t GT_getHashSize(int hash_id)
 void GT_calculateDigest(const unsigned char *data, size_t data_len,
 		unsigned char *result, int hash_alg)
 {
-	EVP_MD_CTX md_ctx;
 	const EVP_MD *evp_md;
-	unsigned int digest_len;
 
 	assert(data != NULL || data_len == 0);
 	assert(result != NULL);
@@ -112,11 +541,7 @@ void GT_calculateDigest(const unsigned char *data, size_t data_len,
 	evp_md = GT_hashChainIDToEVP(hash_alg);
 	assert(evp_md != NULL);
 
-	EVP_DigestInit(&md_ctx, evp_md);
-	EVP_DigestUpdate(&md_ctx, data, data_len);
-	EVP_DigestFinal(&md_ctx, result, &digest_len);
-
-	assert(digest_len == GT_getHashSize(hash_alg));
+	calculateDigestMD(data, data_len, result, hash_alg, evp_md);
 }
 
 static int getStepSize(int hash_alg)
@@ -527,6 +952,657 @@ int GT_hashChainCalculateNoDepth(
 				data, data_length, result, result_length, 0);
 }
 
+/**/
+
+int GTHashChain_compile(
+		const unsigned char *hash_chain, size_t hash_chain_length,
+		GTHashChain **compiled)
+{
+	int res = GT_UNKNOWN_ERROR;
+	GTHashChain *tmp_chain = NULL;
+	GTHashChainStep *step;
+	size_t pos;
+	size_t step_length;
+	int step_count;
+
+	assert(compiled != NULL);
+
+	tmp_chain = OPENSSL_malloc(sizeof(GTHashChain));
+	if (tmp_chain == NULL) {
+		res = GT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+	tmp_chain->steps = NULL;
+	tmp_chain->step_count = 0;
+	if (hash_chain_length > 0) {
+		/* Steps are at least 4 bytes long, this is enough room for all.
+		 * One more, so that a chain shorter than a step is not a zero
+		 * size allocation (NULL in OpenSSL 1.0) but a malformed chain. */
+		tmp_chain->steps = OPENSSL_malloc(
+				(hash_chain_length / 4 + 1) * sizeof(GTHashChainStep));
+		if (tmp_chain->steps == NULL) {
+			res = GT_OUT_OF_MEMORY;
+			goto cleanup;
+		}
+	}
+
+	/* Same checks as HashWalkCtxCheckStep() does during the walk. */
+	step_count = 0;
+	pos = 0;
+	while (pos < hash_chain_length) {
+		step = tmp_chain->steps + step_count;
+
+		if (hash_chain_length - pos < 3) {
+			res = GT_INVALID_LINKING_INFO;
+			goto cleanup;
+		}
+		if (hash_chain[pos + 1] > 1) {
+			res = GT_INVALID_LINKING_INFO;
+			goto cleanup;
+		}
+		if (!GT_isSupportedHashAlgorithm(hash_chain[pos + 2]) ||
+				!GT_isSupportedHashAlgorithm(hash_chain[pos])) {
+			res = GT_UNTRUSTED_HASH_ALGORITHM;
+			goto cleanup;
+		}
+		step->sibling_length = GT_getHashSize(hash_chain[pos + 2]);
+		step_length = step->sibling_length + 4;
+		if (pos + step_length > hash_chain_length) {
+			res = GT_INVALID_LINKING_INFO;
+			goto cleanup;
+		}
+
+		step->input_hash_alg = hash_chain[pos];
+		step->input_md = GT_hashChainIDToEVP(step->input_hash_alg);
+		step->input_hash_length = EVP_MD_size(step->input_md);
+		step->input_is_left = hash_chain[pos + 1];
+		step->sibling_hash_alg = hash_chain[pos + 2];
+		step->sibling = hash_chain + pos + 3;
+		step->level = hash_chain[pos + 3 + step->sibling_length];
+
+		++step_count;
+		pos += step_length;
+	}
+	tmp_chain->step_count = step_count;
+
+	*compiled = tmp_chain;
+	tmp_chain = NULL;
+
+	res = GT_OK;
+
+cleanup:
+	GTHashChain_free(tmp_chain);
+
+	return res;
+}
+
+/**/
+
+void GTHashChain_free(GTHashChain *compiled)
+{
+	if (compiled != NULL) {
+		OPENSSL_free(compiled->steps);
+		OPENSSL_free(compiled);
+	}
+}
+
+/**/
+
+/**
+ * Writes the result of the \p step for the given hash of its input.
+ * \return Returns length of the result.
+ */
+static size_t composeStepResult(const GTHashChainStep *step,
+		const unsigned char *input_hash, unsigned char *result)
+{
+	unsigned char *p = result;
+
+	if (step->input_is_left) {
+		*p++ = step->input_hash_alg;
+		memcpy(p, input_hash, step->input_hash_length);
+		p += step->input_hash_length;
+		*p++ = step->sibling_hash_alg;
+		memcpy(p, step->sibling, step->sibling_length);
+		p += step->sibling_length;
+	} else {
+		*p++ = step->sibling_hash_alg;
+		memcpy(p, step->sibling, step->sibling_length);
+		p += step->sibling_length;
+		*p++ = step->input_hash_alg;
+		memcpy(p, input_hash, step->input_hash_length);
+		p += step->input_hash_length;
+	}
+	*p++ = step->level;
+
+	return p - result;
+}
+
+/**/
+
+int GTHashChain_calculateInto(const GTHashChain *compiled,
+		const unsigned char *data, size_t data_length, int usedepth,
+		unsigned char *result, size_t *result_length)
+{
+	unsigned char input_hash[EVP_MAX_MD_SIZE];
+	const GTHashChainStep *step;
+	size_t len;
+	int prev_level = 0;
+	int i;
+
+	assert(compiled != NULL && data != NULL && data_length != 0 &&
+			result != NULL && result_length != NULL);
+
+	/* For empty hash chain, return copy of the input. */
+	if (compiled->step_count == 0) {
+		if (data_length > MAX_STEP_RESULT_LEN) {
+			return GT_INVALID_ARGUMENT;
+		}
+		memmove(result, data, data_length);
+		*result_length = data_length;
+		return GT_OK;
+	}
+
+	len = 0;
+	for (i = 0; i < compiled->step_count; ++i) {
+		step = compiled->steps + i;
+
+		/* Input of the first step is the data, then the previous result. */
+		if (i == 0) {
+			calculateDigestMD(data, data_length, input_hash,
+					step->input_hash_alg, step->input_md);
+		} else {
+			calculateDigestMD(result, len, input_hash,
+					step->input_hash_alg, step->input_md);
+		}
+
+		/* Like the walk, the depth of the last step is not checked. */
+		if (usedepth && i < compiled->step_count - 1 &&
+				prev_level >= step->level) {
+			return GT_INVALID_LENGTH_BYTES;
+		}
+		prev_level = step->level;
+
+		len = composeStepResult(step, input_hash, result);
+	}
+
+	*result_length = len;
+
+	return GT_OK;
+}
+
+/**/
+
+int GTHashChain_calculate(const GTHashChain *compiled,
+		const unsigned char *data, size_t data_length, int usedepth,
+		unsigned char **result, size_t *result_length)
+{
+	int res = GT_UNKNOWN_ERROR;
+	unsigned char *tmp_res = NULL;
+	size_t tmp_res_len;
+
+	assert(compiled != NULL && data != NULL && data_length != 0 &&
+			result != NULL && result_length != NULL);
+
+	tmp_res = OPENSSL_malloc(compiled->step_count == 0 ?
+			data_length : MAX_STEP_RESULT_LEN);
+	if (tmp_res == NULL) {
+		res = GT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	if (compiled->step_count == 0) {
+		memcpy(tmp_res, data, data_length);
+		tmp_res_len = data_length;
+	} else {
+		res = GTHashChain_calculateInto(compiled, data, data_length,
+				usedepth, tmp_res, &tmp_res_len);
+		if (res != GT_OK) {
+			goto cleanup;
+		}
+	}
+
+	*result = tmp_res;
+	tmp_res = NULL;
+	*result_length = tmp_res_len;
+
+	res = GT_OK;
+
+cleanup:
+	OPENSSL_free(tmp_res);
+
+	return res;
+}
+
+int GTHashChain_calculateBatch(const GTHashChain *const *compiled,
+		int count, int usedepth, unsigned char *const *buffers,
+		size_t *lengths, int *results)
+{
+	int res = GT_UNKNOWN_ERROR;
+	const unsigned char **inputs = NULL;
+	size_t *input_lengths = NULL;
+	unsigned char **input_hashes = NULL;
+	unsigned char *input_hash_buf = NULL;
+	int *lanes = NULL;
+	int *prev_levels = NULL;
+	const GTHashChainStep *step;
+	int max_steps = 0;
+	int lane_count;
+	int hash_alg, prev_hash_alg;
+	int i, j, k;
+
+	assert(compiled != NULL && buffers != NULL && lengths != NULL &&
+			results != NULL);
+
+	if (count <= 0) {
+		return GT_OK;
+	}
+
+	inputs = GT_malloc(count * sizeof(*inputs));
+	input_lengths = GT_malloc(count * sizeof(*input_lengths));
+	input_hashes = GT_malloc(count * sizeof(*input_hashes));
+	input_hash_buf = GT_malloc(count * EVP_MAX_MD_SIZE);
+	lanes = GT_malloc(count * sizeof(*lanes));
+	prev_levels = GT_malloc(count * sizeof(*prev_levels));
+	if (inputs == NULL || input_lengths == NULL || input_hashes == NULL ||
+			input_hash_buf == NULL || lanes == NULL || prev_levels == NULL) {
+		res = GT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	for (i = 0; i < count; ++i) {
+		prev_levels[i] = 0;
+		if (results[i] == GT_OK && compiled[i] != NULL &&
+				compiled[i]->step_count > max_steps) {
+			max_steps = compiled[i]->step_count;
+		}
+	}
+
+	/* All chains make step k before any chain makes step k + 1, so that
+	 * the digests of a step can be calculated together. */
+	for (k = 0; k < max_steps; ++k) {
+		/* Lanes with the same input hash algorithm are hashed together;
+		 * usually all chains use the same one. */
+		prev_hash_alg = -1;
+		for (;;) {
+			hash_alg = -1;
+			for (i = 0; i < count; ++i) {
+				if (results[i] != GT_OK || compiled[i] == NULL ||
+						k >= compiled[i]->step_count) {
+					continue;
+				}
+				step = compiled[i]->steps + k;
+				if (step->input_hash_alg > prev_hash_alg &&
+						(hash_alg < 0 || step->input_hash_alg < hash_alg)) {
+					hash_alg = step->input_hash_alg;
+				}
+			}
+			if (hash_alg < 0) {
+				break;
+			}
+			prev_hash_alg = hash_alg;
+
+			lane_count = 0;
+			for (i = 0; i < count; ++i) {
+				if (results[i] != GT_OK || compiled[i] == NULL ||
+						k >= compiled[i]->step_count ||
+						compiled[i]->steps[k].input_hash_alg != hash_alg) {
+					continue;
+				}
+				lanes[lane_count] = i;
+				inputs[lane_count] = buffers[i];
+				input_lengths[lane_count] = lengths[i];
+				input_hashes[lane_count] = input_hash_buf + i * EVP_MAX_MD_SIZE;
+				++lane_count;
+			}
+
+			multi_digest(lane_count, inputs, input_lengths, input_hashes,
+					hash_alg, compiled[lanes[0]]->steps[k].input_md);
+
+			for (j = 0; j < lane_count; ++j) {
+				i = lanes[j];
+				step = compiled[i]->steps + k;
+
+				/* Like the walk, the depth of the last step is not checked. */
+				if (usedepth && k < compiled[i]->step_count - 1 &&
+						prev_levels[i] >= step->level) {
+					results[i] = GT_INVALID_LENGTH_BYTES;
+					continue;
+				}
+				prev_levels[i] = step->level;
+
+				lengths[i] = composeStepResult(step, input_hashes[j], buffers[i]);
+			}
+		}
+	}
+
+	res = GT_OK;
+
+cleanup:
+	GT_free(inputs);
+	GT_free(input_lengths);
+	GT_free(input_hashes);
+	GT_free(input_hash_buf);
+	GT_free(lanes);
+	GT_free(prev_levels);
+
+	return res;
+}
+
+/*
+ * Cache of history hash chain walks. Timestamps of the same round have
+ * the same history chain, and timestamps of nearby rounds share its upper
+ * part. The cache maps the input of the remaining steps of a chain to the
+ * output of the whole walk, so that the shared part is hashed only once.
+ * Entries are made at the first step and at the steps where the number of
+ * remaining steps is a power of two, which bounds the number of entries
+ * per walk and still skips at least half of any shared part.
+ */
+
+/** Memoized result of the remaining steps of a history hash chain. */
+typedef struct {
+	unsigned long key_hash;
+	unsigned char input[GT_HASHCHAIN_MAX_RESULT_LENGTH];
+	size_t input_length;
+	/* Copy of the raw remaining steps. */
+	unsigned char *steps;
+	size_t steps_length;
+	unsigned char output[GT_HASHCHAIN_MAX_RESULT_LENGTH];
+	size_t output_length;
+} HashChainCacheEntry;
+
+/* Direct-mapped: a new entry replaces the one in its slot. */
+static HashChainCacheEntry **hash_chain_cache = NULL;
+static size_t hash_chain_cache_capacity = 0;
+/* Set with the capacity, but read without the lock, so that verifications
+ * do not contend for it while the cache is disabled. A stale value is
+ * harmless: GTHashChain_calculateCached() checks the capacity again. */
+static volatile int hash_chain_cache_enabled = 0;
+static size_t hash_chain_cache_entries = 0;
+static unsigned long hash_chain_cache_hits = 0;
+static unsigned long hash_chain_cache_misses = 0;
+
+#ifdef _WIN32
+static HANDLE hash_chain_cache_lock = NULL;
+#define LOCK_HASH_CHAIN_CACHE() \
+	WaitForSingleObject(hash_chain_cache_lock, INFINITE)
+#define UNLOCK_HASH_CHAIN_CACHE() ReleaseMutex(hash_chain_cache_lock)
+#else /* _WIN32 */
+static pthread_mutex_t hash_chain_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_HASH_CHAIN_CACHE() pthread_mutex_lock(&hash_chain_cache_lock)
+#define UNLOCK_HASH_CHAIN_CACHE() pthread_mutex_unlock(&hash_chain_cache_lock)
+#endif /* not _WIN32 */
+
+/* Cache positions of a walk: the first step and the steps that have a
+ * power of two steps remaining. */
+#define MAX_CACHE_POSITIONS (8 * sizeof(int) + 1)
+
+/**/
+
+static void HashChainCacheEntry_free(HashChainCacheEntry *entry)
+{
+	if (entry != NULL) {
+		OPENSSL_free(entry->steps);
+		OPENSSL_free(entry);
+	}
+}
+
+/**/
+
+static int isCachePosition(int step, int step_count)
+{
+	int remaining = step_count - step;
+
+	return step == 0 || (remaining & (remaining - 1)) == 0;
+}
+
+/**/
+
+/* Only the input and the first remaining step are hashed to find the
+ * slot; the rest of the steps are compared when the slot is checked. */
+static unsigned long cacheKeyHash(
+		const unsigned char *input, size_t input_length,
+		const unsigned char *steps, size_t steps_length,
+		const GTHashChainStep *first_step)
+{
+	unsigned long h = 2166136261UL;
+	size_t i;
+	size_t first_length = first_step->sibling_length + 4;
+
+	for (i = 0; i < input_length; ++i) {
+		h = (h ^ input[i]) * 16777619UL;
+	}
+	for (i = 0; i < first_length; ++i) {
+		h = (h ^ steps[i]) * 16777619UL;
+	}
+	h = (h ^ steps_length) * 16777619UL;
+
+	return h;
+}
+
+/**/
+
+int GT_initHashChainCache(void)
+{
+#ifdef _WIN32
+	if (hash_chain_cache_lock == NULL) {
+		hash_chain_cache_lock = CreateMutex(NULL, FALSE, NULL);
+		if (hash_chain_cache_lock == NULL) {
+			return GT_OUT_OF_MEMORY;
+		}
+	}
+#endif /* _WIN32 */
+
+	return GT_OK;
+}
+
+/**/
+
+void GT_finalizeHashChainCache(void)
+{
+	GT_setHashChainCacheSize(0);
+#ifdef _WIN32
+	if (hash_chain_cache_lock != NULL) {
+		CloseHandle(hash_chain_cache_lock);
+		hash_chain_cache_lock = NULL;
+	}
+#endif /* _WIN32 */
+}
+
+/**/
+
+int GT_setHashChainCacheSize(size_t max_entries)
+{
+	HashChainCacheEntry **new_cache = NULL;
+	HashChainCacheEntry **old_cache;
+	size_t old_capacity;
+	size_t capacity = 0;
+	size_t i;
+
+	if (max_entries > 0) {
+		/* Round down to a power of two for the slot mask. */
+		capacity = 1;
+		while (capacity <= max_entries / 2) {
+			capacity *= 2;
+		}
+		new_cache = OPENSSL_malloc(capacity * sizeof(*new_cache));
+		if (new_cache == NULL) {
+			return GT_OUT_OF_MEMORY;
+		}
+		for (i = 0; i < capacity; ++i) {
+			new_cache[i] = NULL;
+		}
+	}
+
+	LOCK_HASH_CHAIN_CACHE();
+	old_cache = hash_chain_cache;
+	old_capacity = hash_chain_cache_capacity;
+	hash_chain_cache = new_cache;
+	hash_chain_cache_capacity = capacity;
+	hash_chain_cache_enabled = capacity > 0;
+	hash_chain_cache_entries = 0;
+	hash_chain_cache_hits = 0;
+	hash_chain_cache_misses = 0;
+	UNLOCK_HASH_CHAIN_CACHE();
+
+	for (i = 0; i < old_capacity; ++i) {
+		HashChainCacheEntry_free(old_cache[i]);
+	}
+	OPENSSL_free(old_cache);
+
+	return GT_OK;
+}
+
+/**/
+
+void GT_getHashChainCacheStats(GTHashChainCacheStats *stats)
+{
+	assert(stats != NULL);
+
+	LOCK_HASH_CHAIN_CACHE();
+	stats->capacity = hash_chain_cache_capacity;
+	stats->entries = hash_chain_cache_entries;
+	stats->hits = hash_chain_cache_hits;
+	stats->misses = hash_chain_cache_misses;
+	UNLOCK_HASH_CHAIN_CACHE();
+}
+
+/**/
+
+int GT_isHashChainCacheEnabled(void)
+{
+	return hash_chain_cache_enabled;
+}
+
+/**/
+
+int GTHashChain_calculateCached(const GTHashChain *compiled,
+		const unsigned char *data, size_t data_length,
+		unsigned char *result, size_t *result_length)
+{
+	unsigned char input_hash[EVP_MAX_MD_SIZE];
+	/* Inputs at the cache positions passed before the hit, if any. */
+	unsigned char inputs[MAX_CACHE_POSITIONS][GT_HASHCHAIN_MAX_RESULT_LENGTH];
+	size_t input_lengths[MAX_CACHE_POSITIONS];
+	int positions[MAX_CACHE_POSITIONS];
+	unsigned long key_hashes[MAX_CACHE_POSITIONS];
+	int position_count = 0;
+	const GTHashChainStep *step;
+	const unsigned char *steps_end;
+	const unsigned char *steps;
+	size_t steps_length;
+	const unsigned char *input;
+	size_t input_length;
+	HashChainCacheEntry *entry;
+	int hit = 0;
+	size_t len;
+	int i, j;
+
+	assert(compiled != NULL && data != NULL && data_length != 0 &&
+			result != NULL && result_length != NULL);
+
+	if (compiled->step_count == 0) {
+		return GTHashChain_calculateInto(
+				compiled, data, data_length, 0, result, result_length);
+	}
+
+	/* Steps point into the raw chain, so the remaining raw steps can be
+	 * compared without copying. */
+	step = compiled->steps + compiled->step_count - 1;
+	steps_end = step->sibling + step->sibling_length + 1;
+
+	len = 0;
+	for (i = 0; i < compiled->step_count; ++i) {
+		step = compiled->steps + i;
+		input = i == 0 ? data : result;
+		input_length = i == 0 ? data_length : len;
+
+		if (isCachePosition(i, compiled->step_count) &&
+				input_length <= GT_HASHCHAIN_MAX_RESULT_LENGTH) {
+			steps = step->sibling - 3;
+			steps_length = steps_end - steps;
+			key_hashes[position_count] = cacheKeyHash(
+					input, input_length, steps, steps_length, step);
+
+			LOCK_HASH_CHAIN_CACHE();
+			entry = NULL;
+			if (hash_chain_cache_capacity > 0) {
+				entry = hash_chain_cache[key_hashes[position_count] &
+					(hash_chain_cache_capacity - 1)];
+			}
+			if (entry != NULL &&
+					entry->key_hash == key_hashes[position_count] &&
+					entry->input_length == input_length &&
+					entry->steps_length == steps_length &&
+					memcmp(entry->input, input, input_length) == 0 &&
+					memcmp(entry->steps, steps, steps_length) == 0) {
+				memcpy(result, entry->output, entry->output_length);
+				len = entry->output_length;
+				hit = 1;
+			}
+			UNLOCK_HASH_CHAIN_CACHE();
+			if (hit) {
+				break;
+			}
+
+			memcpy(inputs[position_count], input, input_length);
+			input_lengths[position_count] = input_length;
+			positions[position_count] = i;
+			++position_count;
+		}
+
+		calculateDigestMD(input, input_length, input_hash,
+				step->input_hash_alg, step->input_md);
+		len = composeStepResult(step, input_hash, result);
+	}
+
+	*result_length = len;
+
+	/* Remember the result for the positions that were walked. Entries that
+	 * can not be allocated are just not remembered. */
+	LOCK_HASH_CHAIN_CACHE();
+	if (hit) {
+		++hash_chain_cache_hits;
+	} else {
+		++hash_chain_cache_misses;
+	}
+	for (j = 0; j < position_count && hash_chain_cache_capacity > 0; ++j) {
+		HashChainCacheEntry **slot = hash_chain_cache +
+			(key_hashes[j] & (hash_chain_cache_capacity - 1));
+
+		step = compiled->steps + positions[j];
+		steps = step->sibling - 3;
+		steps_length = steps_end - steps;
+
+		entry = OPENSSL_malloc(sizeof(HashChainCacheEntry));
+		if (entry == NULL) {
+			break;
+		}
+		entry->steps = OPENSSL_malloc(steps_length);
+		if (entry->steps == NULL) {
+			OPENSSL_free(entry);
+			break;
+		}
+		entry->key_hash = key_hashes[j];
+		memcpy(entry->input, inputs[j], input_lengths[j]);
+		entry->input_length = input_lengths[j];
+		memcpy(entry->steps, steps, steps_length);
+		entry->steps_length = steps_length;
+		memcpy(entry->output, result, len);
+		entry->output_length = len;
+
+		if (*slot == NULL) {
+			++hash_chain_cache_entries;
+		}
+		HashChainCacheEntry_free(*slot);
+		*slot = entry;
+	}
+	UNLOCK_HASH_CHAIN_CACHE();
+
+	return GT_OK;
+}
+
+/**/
+
 /**
  * Hash chain construction
  * Return GT_OK, if OK, else error code.
@@ -649,6 +1725,253 @@ unsigned char *GTHCConstructor_getHashChain(GTHCConstructor *hc_cons,
 	return ret;
 }
 
+/* Creates a copy of data hash, or a new one with given algorithm and
+ * uninitialized digest if data_hash is NULL. */
+static GTDataHash *newDataHash(const GTDataHash *data_hash, int hash_algorithm)
+{
+	GTDataHash *ret = NULL;
+	size_t len = (data_hash != NULL) ?
+		data_hash->digest_length : GT_getHashSize(hash_algorithm);
+
+	ret = GT_malloc(sizeof(GTDataHash));
+	if (ret == NULL) {
+		return NULL;
+	}
+	ret->context = NULL;
+	ret->digest_length = len;
+	ret->algorithm = (data_hash != NULL) ? data_hash->algorithm : hash_algorithm;
+	ret->digest = GT_malloc(len);
+	if (ret->digest == NULL) {
+		GT_free(ret);
+		return NULL;
+	}
+	if (data_hash != NULL) {
+		memcpy(ret->digest, data_hash->digest, len);
+	}
+	return ret;
+}
+
+/**/
+
+int GTDataHash_aggregate(const GTDataHash *const *leaves, int leaf_count,
+		int hash_algorithm, GTDataHash **root,
+		unsigned char **hash_chains, size_t *hash_chain_lengths)
+{
+	int res = GT_UNKNOWN_ERROR;
+	int tmp_res;
+	GTHCConstructor **constructors = NULL;
+	unsigned char *nodes = NULL;
+	unsigned char *tmp_chain;
+	unsigned char step_result[MAX_STEP_RESULT_LEN];
+	size_t step_result_len;
+	GTDataHash *tmp_root = NULL;
+	size_t hash_size;
+	int node_count;
+	int step_count;
+	int level;
+	int span;
+	int i, j;
+
+	if (leaves == NULL || leaf_count <= 0 || root == NULL ||
+			hash_chains == NULL || hash_chain_lengths == NULL) {
+		res = GT_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	for (i = 0; i < leaf_count; ++i) {
+		hash_chains[i] = NULL;
+		hash_chain_lengths[i] = 0;
+		if (leaves[i] == NULL || leaves[i]->digest == NULL ||
+				leaves[i]->digest_length == 0) {
+			res = GT_INVALID_ARGUMENT;
+			goto cleanup;
+		}
+	}
+
+	hash_algorithm = GT_fixHashAlgorithm(hash_algorithm);
+	if (!GT_isSupportedHashAlgorithm(hash_algorithm)) {
+		res = GT_UNTRUSTED_HASH_ALGORITHM;
+		goto cleanup;
+	}
+	hash_size = GT_getHashSize(hash_algorithm);
+
+	/* Trivial tree, the only leaf is also the root. */
+	if (leaf_count == 1) {
+		tmp_root = newDataHash(leaves[0], hash_algorithm);
+		if (tmp_root == NULL) {
+			res = GT_OUT_OF_MEMORY;
+			goto cleanup;
+		}
+		*root = tmp_root;
+		tmp_root = NULL;
+		res = GT_OK;
+		goto cleanup;
+	}
+
+	for (step_count = 0; (1 << step_count) < leaf_count; ++step_count);
+
+	nodes = GT_malloc(leaf_count * hash_size);
+	constructors = GT_calloc(leaf_count, sizeof(GTHCConstructor *));
+	if (nodes == NULL || constructors == NULL) {
+		res = GT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+
+	/* The hash chain calculation starts with hashing the input. */
+	for (i = 0; i < leaf_count; ++i) {
+		tmp_res = GTHCConstructor_new(hash_algorithm, step_count,
+				&constructors[i]);
+		if (tmp_res != GT_OK) {
+			res = tmp_res;
+			goto cleanup;
+		}
+		GT_calculateDigest(leaves[i]->digest, leaves[i]->digest_length,
+				nodes + i * hash_size, hash_algorithm);
+	}
+
+	/* Nodes of each level are computed in place. Node i of the current
+	 * level covers leaves [i * span, (i + 1) * span). */
+	node_count = leaf_count;
+	span = 1;
+	level = 1;
+	while (node_count > 1) {
+		for (i = 0; i + 1 < node_count; i += 2) {
+			const unsigned char *left = nodes + i * hash_size;
+			const unsigned char *right = nodes + (i + 1) * hash_size;
+
+			for (j = i * span; j < (i + 1) * span; ++j) {
+				tmp_res = GTHCConstructor_addStep(constructors[j],
+						hash_algorithm, right, 1, level);
+				if (tmp_res != GT_OK) {
+					res = tmp_res;
+					goto cleanup;
+				}
+			}
+			for (j = (i + 1) * span; j < (i + 2) * span && j < leaf_count; ++j) {
+				tmp_res = GTHCConstructor_addStep(constructors[j],
+						hash_algorithm, left, 0, level);
+				if (tmp_res != GT_OK) {
+					res = tmp_res;
+					goto cleanup;
+				}
+			}
+
+			concatenateArguments(hash_algorithm, left, hash_algorithm, right,
+					level, step_result, &step_result_len);
+			GT_calculateDigest(step_result, step_result_len,
+					nodes + (i / 2) * hash_size, hash_algorithm);
+		}
+		if (node_count % 2 == 1) {
+			/* Last node has no sibling and is promoted as it is. */
+			memmove(nodes + (node_count / 2) * hash_size,
+					nodes + (node_count - 1) * hash_size, hash_size);
+		}
+		node_count = (node_count + 1) / 2;
+		span *= 2;
+		++level;
+	}
+
+	tmp_root = newDataHash(NULL, hash_algorithm);
+	if (tmp_root == NULL) {
+		res = GT_OUT_OF_MEMORY;
+		goto cleanup;
+	}
+	memcpy(tmp_root->digest, nodes, hash_size);
+
+	/* Hash chains are returned in GT_malloc()-ed memory. */
+	for (i = 0; i < leaf_count; ++i) {
+		size_t len;
+
+		tmp_chain = GTHCConstructor_getHashChain(constructors[i], &len);
+		hash_chains[i] = GT_malloc(len);
+		if (hash_chains[i] == NULL) {
+			OPENSSL_free(tmp_chain);
+			res = GT_OUT_OF_MEMORY;
+			goto cleanup;
+		}
+		memcpy(hash_chains[i], tmp_chain, len);
+		hash_chain_lengths[i] = len;
+		OPENSSL_free(tmp_chain);
+	}
+
+	*root = tmp_root;
+	tmp_root = NULL;
+	res = GT_OK;
+
+cleanup:
+	if (res != GT_OK && hash_chains != NULL && leaf_count > 0) {
+		for (i = 0; i < leaf_count; ++i) {
+			GT_free(hash_chains[i]);
+			hash_chains[i] = NULL;
+			hash_chain_lengths[i] = 0;
+		}
+	}
+	if (constructors != NULL) {
+		for (i = 0; i < leaf_count; ++i) {
+			GTHCConstructor_free(constructors[i]);
+		}
+	}
+	GT_free(constructors);
+	GT_free(nodes);
+	GTDataHash_free(tmp_root);
+
+	return res;
+}
+
+/**/
+
+int GTDataHash_aggregationRoot(const GTDataHash *leaf,
+		const unsigned char *hash_chain, size_t hash_chain_length,
+		GTDataHash **root)
+{
+	int res = GT_UNKNOWN_ERROR;
+	int tmp_res;
+	unsigned char *step_result = NULL;
+	size_t step_result_len;
+	GTDataHash *tmp_root = NULL;
+
+	if (leaf == NULL || leaf->digest == NULL || leaf->digest_length == 0 ||
+			(hash_chain == NULL && hash_chain_length != 0) || root == NULL) {
+		res = GT_INVALID_ARGUMENT;
+		goto cleanup;
+	}
+
+	if (hash_chain_length == 0) {
+		tmp_root = newDataHash(leaf, leaf->algorithm);
+		if (tmp_root == NULL) {
+			res = GT_OUT_OF_MEMORY;
+			goto cleanup;
+		}
+	} else {
+		tmp_res = GT_hashChainCalculate(hash_chain, hash_chain_length,
+				leaf->digest, leaf->digest_length,
+				&step_result, &step_result_len);
+		if (tmp_res != GT_OK) {
+			res = tmp_res;
+			goto cleanup;
+		}
+
+		/* Tree nodes are hashed with the input algorithm of the chain. */
+		tmp_root = newDataHash(NULL, hash_chain[0]);
+		if (tmp_root == NULL) {
+			res = GT_OUT_OF_MEMORY;
+			goto cleanup;
+		}
+		GT_calculateDigest(step_result, step_result_len, tmp_root->digest,
+				tmp_root->algorithm);
+	}
+
+	*root = tmp_root;
+	tmp_root = NULL;
+	res = GT_OK;
+
+cleanup:
+	OPENSSL_free(step_result);
+	GTDataHash_free(tmp_root);
+
+	return res;
+}
+
 /**/
 
 int GT_setHashAlgorithmIdentifier(
@@ -776,6 +2099,28 @@ cleanup:
 
 /**/
 
+int GT_calculateDataImprintInto(const void *data, size_t data_len,
+		int hash_alg, unsigned char *result, size_t *result_length)
+{
+	size_t hash_size;
+
+	assert((data != NULL || data_len == 0) && result != NULL &&
+			result_length != NULL);
+
+	hash_size = GT_getHashSize(hash_alg);
+	if (hash_size == 0) {
+		return GT_CRYPTO_FAILURE;
+	}
+
+	result[0] = GT_fixHashAlgorithm(hash_alg);
+	GT_calculateDigest(data, data_len, result + 1, hash_alg);
+	*result_length = hash_size + 1;
+
+	return GT_OK;
+}
+
+/**/
+
 int GT_calculateDataImprint(const void *data, size_t data_len,
 		int hash_alg, ASN1_OCTET_STRING **result)
 {
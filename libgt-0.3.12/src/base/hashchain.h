@@ -38,6 +38,40 @@ extern "C" {
  */
 #define IRRELEVANT_HASHSTEP_DEPTH 255
 
+/**
+ * Maximum length of a hash step result: two hashes in DataImprint format
+ * and the depth byte.
+ */
+#define GT_HASHCHAIN_MAX_RESULT_LENGTH (2 * EVP_MAX_MD_SIZE + 3)
+
+/**
+ * Sets up per-thread digest contexts used by \c GT_calculateDigest() and
+ * the hash chain calculation. Called from \c GT_init().
+ */
+int GT_initDigestContexts(void);
+
+/**
+ * Frees per-thread digest contexts. Called from \c GT_finalize().
+ */
+void GT_finalizeDigestContexts(void);
+
+/**
+ * Sets up the lock of the history hash chain cache. Called from
+ * \c GT_init().
+ */
+int GT_initHashChainCache(void);
+
+/**
+ * Frees the history hash chain cache. Called from \c GT_finalize().
+ */
+void GT_finalizeHashChainCache(void);
+
+/**
+ * \return Returns non-zero, if the history hash chain cache is enabled
+ * with \c GT_setHashChainCacheSize().
+ */
+int GT_isHashChainCacheEnabled(void);
+
 /**
  * Is \p hash_id hash algorithm supported?
  */
@@ -86,6 +120,114 @@ int GT_hashChainCalculateNoDepth(
 		const unsigned char *data, size_t data_length,
 		unsigned char **result, size_t *result_length);
 
+/**
+ * This structure holds a single pre-parsed step of a hash chain.
+ */
+typedef struct GTHashChainStep_st {
+	/**
+	 * Algorithm used to hash the input of the step, and its size.
+	 */
+	const EVP_MD *input_md;
+	int input_hash_alg;
+	size_t input_hash_length;
+	/**
+	 * 1, if the input is the left argument of the step, 0 otherwise.
+	 */
+	int input_is_left;
+	/**
+	 * Constant argument of the step. Points into the raw hash chain, which
+	 * must stay alive as long as this structure is used.
+	 */
+	int sibling_hash_alg;
+	const unsigned char *sibling;
+	size_t sibling_length;
+	/**
+	 * Depth (level) byte of the step.
+	 */
+	int level;
+} GTHashChainStep;
+
+/**
+ * This structure holds a hash chain that has been parsed and checked once,
+ * so that it can be applied to the input repeatedly without re-parsing.
+ */
+typedef struct GTHashChain_st {
+	GTHashChainStep *steps;
+	int step_count;
+} GTHashChain;
+
+/**
+ * Parses and checks the raw hash chain.
+ *
+ * \param hash_chain \c (in) - Buffer containing hash chain. It is not
+ * copied, so it must not be freed before the result.
+ * \param hash_chain_length \c (in) - Length of \p hash_chain, in bytes.
+ * \param compiled \c (out) - Pointer that will receive pointer to the
+ * parsed hash chain. It must be freed with \c GTHashChain_free().
+ * \return status code (\c GT_OK, when operation succeeded, otherwise an
+ * error code if the chain is malformed).
+ */
+int GTHashChain_compile(
+		const unsigned char *hash_chain, size_t hash_chain_length,
+		GTHashChain **compiled);
+
+/**
+ * Frees the parsed hash chain.
+ */
+void GTHashChain_free(GTHashChain *compiled);
+
+/**
+ * Same as \c GT_hashChainCalculate() and \c GT_hashChainCalculateNoDepth()
+ * (if \p usedepth is 0), but applies the parsed hash chain.
+ *
+ * \note The caller must free \p result pointer using OPENSSL_free.
+ */
+int GTHashChain_calculate(const GTHashChain *compiled,
+		const unsigned char *data, size_t data_length, int usedepth,
+		unsigned char **result, size_t *result_length);
+
+/**
+ * Same as \c GTHashChain_calculate(), but writes the result to the buffer
+ * given by the caller and does not allocate memory.
+ *
+ * \param result \c (out) - Buffer of at least
+ * \c GT_HASHCHAIN_MAX_RESULT_LENGTH bytes. It may be the same as \p data.
+ */
+int GTHashChain_calculateInto(const GTHashChain *compiled,
+		const unsigned char *data, size_t data_length, int usedepth,
+		unsigned char *result, size_t *result_length);
+
+/**
+ * Applies many hash chains at once. The chains are walked in lock-step, so
+ * that the digests of the same step of all chains can be calculated
+ * together (with multi-buffer SHA-256 on CPUs that support it).
+ *
+ * \param compiled \c (in) - Array of \p count chains. Chains that are
+ * \c NULL are skipped.
+ * \param count \c (in) - Number of chains.
+ * \param usedepth \c (in) - Same as for \c GTHashChain_calculate().
+ * \param buffers \c (in/out) - Array of \p count buffers of at least
+ * \c GT_HASHCHAIN_MAX_RESULT_LENGTH bytes, containing the input of every
+ * chain. Results are written to the same buffers.
+ * \param lengths \c (in/out) - Lengths of the inputs and results.
+ * \param results \c (in/out) - Status of every chain. Chains with status
+ * other than \c GT_OK are skipped; failing chains get the error code.
+ * \return \c GT_OK, or an error code if the whole batch failed.
+ */
+int GTHashChain_calculateBatch(const GTHashChain *const *compiled,
+		int count, int usedepth, unsigned char *const *buffers,
+		size_t *lengths, int *results);
+
+/**
+ * Same as \c GTHashChain_calculateInto() without depth checks (as for the
+ * history chain), but looks up and remembers the results in the history
+ * hash chain cache. When the input of the remaining steps and the steps
+ * themselves are found in the cache, the rest of the walk is skipped.
+ */
+int GTHashChain_calculateCached(const GTHashChain *compiled,
+		const unsigned char *data, size_t data_length,
+		unsigned char *result, size_t *result_length);
+
 /**
  * Converts hash algorithm ID from EVP_MD to integer value used in
  * hash chain calculations (e.g. GT_ALGID_SHA1).
@@ -208,6 +350,25 @@ int GT_calculateMessageImprint(const unsigned char* hashed_data,
 		size_t hashed_data_len, int hash_algorithm,
 		GTMessageImprint **hash);
 
+/**
+ * Calculates the digest of the given data in DataImprint format into the
+ * buffer given by the caller.
+ *
+ * \param data Pointer to the data to be hashed.
+ *
+ * \param data_len Length of the data too be hashed.
+ *
+ * \param hash_alg Identifier of the hash algorithm to be used.
+ *
+ * \param result Buffer of at least \c EVP_MAX_MD_SIZE + 1 bytes.
+ *
+ * \param result_length Pointer to the length of the result.
+ *
+ * \return \c GT_OK on success, an error code otherwise.
+ */
+int GT_calculateDataImprintInto(const void *data, size_t data_len,
+		int hash_alg, unsigned char *result, size_t *result_length);
+
 /**
  * Calculates the digest of the given data and returns it as DataImprint
  * structure (ASN1_OCTET_STRING actually).
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2008-2010 GuardTime AS
+ *
+ * This file is part of the GuardTime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * Test that the hash chain check of a timestamp does not allocate memory.
+ *
+ * OpenSSL memory functions are replaced with counting ones, the hash chain
+ * check is run once to set up the digest contexts of the thread, and then
+ * GTHashChain_calculateInto() and the whole checkHashChain() path (signed
+ * attributes, location and history chains, final imprint) are run again
+ * and must not allocate. The history chain cache is not enabled.
+ *
+ * gt_timestamp.c is included to reach the static checkHashChain(), so it
+ * is left out of the sources when building. From this directory:
+ *     cc -I../src/base hashchain_alloc_test.c \
+ *         $(ls ../src/base/[a-z]*.c | grep -v gt_timestamp.c) -lcrypto -lpthread
+ *     ./a.out TestData.txt.gtts1
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <openssl/crypto.h>
+
+#include "gt_timestamp.c"
+
+#define ROUNDS 100
+
+static int counting = 0;
+static unsigned long allocations = 0;
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static void *countingMalloc(size_t size)
+{
+	allocations += counting;
+	return malloc(size);
+}
+
+static void *countingRealloc(void *p, size_t size)
+{
+	allocations += counting;
+	return realloc(p, size);
+}
+
+static void countingFree(void *p)
+{
+	free(p);
+}
+#else
+static void *countingMalloc(size_t size, const char *file, int line)
+{
+	allocations += counting;
+	return malloc(size);
+}
+
+static void *countingRealloc(void *p, size_t size, const char *file, int line)
+{
+	allocations += counting;
+	return realloc(p, size);
+}
+
+static void countingFree(void *p, const char *file, int line)
+{
+	free(p);
+}
+#endif
+
+/**/
+
+static unsigned char *readFile(const char *name, size_t *length)
+{
+	FILE *f;
+	long size;
+	unsigned char *data = NULL;
+
+	f = fopen(name, "rb");
+	if (f == NULL) {
+		return NULL;
+	}
+	if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) > 0 &&
+			fseek(f, 0, SEEK_SET) == 0) {
+		data = malloc(size);
+		if (data != NULL && fread(data, 1, size, f) != (size_t) size) {
+			free(data);
+			data = NULL;
+		}
+		*length = size;
+	}
+	fclose(f);
+
+	return data;
+}
+
+/**/
+
+static int check(const char *name, const GTTimestamp *timestamp)
+{
+	int res = GT_UNKNOWN_ERROR;
+	unsigned char input[GT_HASHCHAIN_MAX_RESULT_LENGTH];
+	unsigned char output[GT_HASHCHAIN_MAX_RESULT_LENGTH];
+	size_t input_len;
+	size_t output_len;
+	int round;
+
+	if (timestamp->location_chain == NULL ||
+			timestamp->history_chain == NULL) {
+		fprintf(stderr, "%s: hash chains not compiled\n", name);
+		return GT_INVALID_FORMAT;
+	}
+
+	/* Sets up the digest contexts of this thread. */
+	res = checkHashChain(timestamp);
+	if (res != GT_OK) {
+		fprintf(stderr, "%s: %s\n", name, GT_getErrorString(res));
+		return res;
+	}
+	res = prepareHashChainInput(timestamp, input, &input_len);
+	if (res != GT_OK) {
+		fprintf(stderr, "%s: %s\n", name, GT_getErrorString(res));
+		return res;
+	}
+
+	allocations = 0;
+	counting = 1;
+	for (round = 0; round < ROUNDS && res == GT_OK; ++round) {
+		res = GTHashChain_calculateInto(timestamp->location_chain,
+				input, input_len, 1, output, &output_len);
+		if (res == GT_OK) {
+			res = GTHashChain_calculateInto(timestamp->history_chain,
+					output, output_len, 0, output, &output_len);
+		}
+		if (res == GT_OK) {
+			res = checkHashChain(timestamp);
+		}
+	}
+	counting = 0;
+
+	if (res != GT_OK) {
+		fprintf(stderr, "%s: %s\n", name, GT_getErrorString(res));
+		return res;
+	}
+	if (allocations != 0) {
+		fprintf(stderr, "%s: %lu allocations in %d checks\n",
+				name, allocations, ROUNDS);
+		return GT_UNKNOWN_ERROR;
+	}
+
+	printf("%s: no allocations in %d checks\n", name, ROUNDS);
+
+	return GT_OK;
+}
+
+/**/
+
+int main(int argc, char **argv)
+{
+	int res = GT_OK;
+	unsigned char *data;
+	size_t length;
+	GTTimestamp *timestamp;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s timestamp...\n", argv[0]);
+		return 2;
+	}
+
+	/* Must be done before OpenSSL allocates anything. */
+	if (!CRYPTO_set_mem_functions(
+				countingMalloc, countingRealloc, countingFree)) {
+		fprintf(stderr, "cannot replace OpenSSL memory functions\n");
+		return 2;
+	}
+
+	res = GT_init();
+	if (res != GT_OK) {
+		fprintf(stderr, "%s\n", GT_getErrorString(res));
+		return 1;
+	}
+
+	for (i = 1; i < argc && res == GT_OK; ++i) {
+		data = readFile(argv[i], &length);
+		if (data == NULL) {
+			fprintf(stderr, "%s: cannot read\n", argv[i]);
+			res = GT_IO_ERROR;
+			break;
+		}
+		res = GTTimestamp_DERDecode(data, length, &timestamp);
+		free(data);
+		if (res != GT_OK) {
+			fprintf(stderr, "%s: %s\n", argv[i], GT_getErrorString(res));
+			break;
+		}
+		res = check(argv[i], timestamp);
+		GTTimestamp_free(timestamp);
+	}
+
+	GT_finalize();
+
+	return res == GT_OK ? 0 : 1;
+}
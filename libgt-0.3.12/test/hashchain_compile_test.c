@@ -0,0 +1,100 @@
+/*
+ * Copyright 2008-2010 GuardTime AS
+ *
+ * This file is part of the GuardTime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * Test of GTHashChain_compile() on truncated hash chains.
+ *
+ * A chain of two SHA-256 steps is cut at every length. The empty and the
+ * complete chains must compile, every other length must be reported as
+ * invalid linking info (not as out of memory, which would fail decoding
+ * of the whole timestamp).
+ *
+ * Build from this directory with:
+ *     cc -I../src/base hashchain_compile_test.c ../src/base/[a-z]*.c -lcrypto
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gt_base.h"
+#include "hashchain.h"
+
+#define SIBLING_LENGTH 32
+#define STEP_LENGTH (SIBLING_LENGTH + 4)
+#define STEPS 2
+
+static void buildChain(unsigned char *chain)
+{
+	unsigned char *p;
+	int i;
+
+	for (i = 0; i < STEPS; ++i) {
+		p = chain + i * STEP_LENGTH;
+		p[0] = GT_HASHALG_SHA256;
+		p[1] = (unsigned char) (i % 2);
+		p[2] = GT_HASHALG_SHA256;
+		memset(p + 3, i + 1, SIBLING_LENGTH);
+		p[3 + SIBLING_LENGTH] = (unsigned char) (i + 1);
+	}
+}
+
+/**/
+
+int main(void)
+{
+	int res;
+	int failures = 0;
+	unsigned char chain[STEPS * STEP_LENGTH];
+	GTHashChain *compiled;
+	size_t length;
+	int expected_steps;
+
+	res = GT_init();
+	if (res != GT_OK) {
+		fprintf(stderr, "%s\n", GT_getErrorString(res));
+		return 1;
+	}
+
+	buildChain(chain);
+
+	for (length = 0; length <= sizeof(chain); ++length) {
+		compiled = NULL;
+		res = GTHashChain_compile(chain, length, &compiled);
+		if (length % STEP_LENGTH == 0) {
+			expected_steps = (int) (length / STEP_LENGTH);
+			if (res != GT_OK || compiled->step_count != expected_steps) {
+				fprintf(stderr, "length %u: %s, expected %d steps\n",
+						(unsigned) length, GT_getErrorString(res),
+						expected_steps);
+				++failures;
+			}
+		} else if (res != GT_INVALID_LINKING_INFO) {
+			fprintf(stderr, "length %u: %s, expected %s\n",
+					(unsigned) length, GT_getErrorString(res),
+					GT_getErrorString(GT_INVALID_LINKING_INFO));
+			++failures;
+		}
+		GTHashChain_free(compiled);
+	}
+
+	GT_finalize();
+
+	if (failures == 0) {
+		printf("truncated hash chains: ok\n");
+	}
+
+	return failures == 0 ? 0 : 1;
+}
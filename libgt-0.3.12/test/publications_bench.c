@@ -0,0 +1,220 @@
+/*
+ * Copyright 2008-2010 GuardTime AS
+ *
+ * This file is part of the GuardTime client SDK.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or
+ * implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * Benchmark of publication lookups by identifier.
+ *
+ * Builds synthetic publications files with a daily and with a monthly
+ * publication cadence and looks up every publication in them with
+ * GTPublicationsFile_getPublishedData(); decoding of the files is timed as
+ * well. The monthly cadence is the worst case for lookups that guess the
+ * cell from the number of days since the first publication.
+ *
+ * Build from this directory with:
+ *     cc -O2 -I../src/base publications_bench.c ../src/base/*.c -lcrypto
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/pkcs7.h>
+
+#include "gt_base.h"
+#include "gt_asn1.h"
+#include "gt_publicationsfile.h"
+
+#define HEADER_LENGTH 36
+#define CELL_SIZE (8 + 1 + 32)
+#define FIRST_IDENT 1200000000LL
+#define ROUNDS 20
+
+static void writeInt(unsigned char *p, long long value, int length)
+{
+	while (length-- > 0) {
+		p[length] = (unsigned char) value;
+		value >>= 8;
+	}
+}
+
+/**/
+
+/* Builds a publications file with count SHA-256 publications, one in
+ * every interval seconds. The signature block is an empty PKCS#7
+ * SignedData: it is decoded, but not verified by the lookups. */
+static unsigned char *buildFile(unsigned int count, long long interval,
+		size_t *length)
+{
+	static const unsigned char pub_reference[] = {
+		0x31, 0x03, 0x04, 0x01, 'x'
+	};
+	PKCS7 *p7;
+	unsigned char *signature = NULL;
+	int signature_length;
+	unsigned char *data;
+	unsigned char *p;
+	size_t data_block_begin = HEADER_LENGTH;
+	size_t key_hashes_begin = data_block_begin + (size_t) count * CELL_SIZE;
+	size_t pub_reference_begin = key_hashes_begin + CELL_SIZE;
+	size_t signature_block_begin;
+	unsigned int i;
+
+	p7 = PKCS7_new();
+	if (p7 == NULL || !PKCS7_set_type(p7, NID_pkcs7_signed) ||
+			!PKCS7_content_new(p7, NID_pkcs7_data)) {
+		return NULL;
+	}
+	signature_length = i2d_PKCS7(p7, &signature);
+	PKCS7_free(p7);
+	if (signature_length <= 0) {
+		return NULL;
+	}
+
+	signature_block_begin = pub_reference_begin + sizeof(pub_reference);
+	*length = signature_block_begin + signature_length;
+	data = calloc(*length, 1);
+	if (data == NULL) {
+		OPENSSL_free(signature);
+		return NULL;
+	}
+
+	writeInt(data + 0, 1, 2);
+	writeInt(data + 2, FIRST_IDENT, 8);
+	writeInt(data + 10, data_block_begin, 4);
+	writeInt(data + 14, CELL_SIZE, 2);
+	writeInt(data + 16, count, 4);
+	writeInt(data + 20, key_hashes_begin, 4);
+	writeInt(data + 24, CELL_SIZE, 2);
+	writeInt(data + 26, 1, 2);
+	writeInt(data + 28, pub_reference_begin, 4);
+	writeInt(data + 32, signature_block_begin, 4);
+
+	for (i = 0; i < count; ++i) {
+		p = data + data_block_begin + (size_t) i * CELL_SIZE;
+		writeInt(p, FIRST_IDENT + i * interval, 8);
+		p[8] = GT_HASHALG_SHA256;
+		writeInt(p + 9, i, 4);
+	}
+
+	p = data + key_hashes_begin;
+	writeInt(p, FIRST_IDENT, 8);
+	p[8] = GT_HASHALG_SHA256;
+
+	memcpy(data + pub_reference_begin, pub_reference, sizeof(pub_reference));
+	memcpy(data + signature_block_begin, signature, signature_length);
+	OPENSSL_free(signature);
+
+	return data;
+}
+
+/**/
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**/
+
+static int run(const char *name, unsigned int count, long long interval)
+{
+	int res = GT_UNKNOWN_ERROR;
+	unsigned char *data;
+	size_t length;
+	GTPublicationsFile *pub = NULL;
+	GTPublishedData *published_data;
+	double start;
+	double decode;
+	double lookup;
+	double total = 0;
+	double worst = 0;
+	unsigned int i;
+	int round;
+
+	data = buildFile(count, interval, &length);
+	if (data == NULL) {
+		fprintf(stderr, "%s: cannot build file\n", name);
+		return GT_OUT_OF_MEMORY;
+	}
+
+	start = now();
+	for (round = 0; round < ROUNDS; ++round) {
+		GTPublicationsFile_free(pub);
+		pub = NULL;
+		res = GTPublicationsFile_DERDecodeBorrowed(data, length, &pub);
+		if (res != GT_OK) {
+			fprintf(stderr, "%s: %s\n", name, GT_getErrorString(res));
+			goto cleanup;
+		}
+	}
+	decode = (now() - start) / ROUNDS;
+
+	/* Each publication is looked up ROUNDS times in a row, so that the
+	 * worst case is not just timer or scheduling noise. */
+	for (i = 0; i < count; ++i) {
+		start = now();
+		for (round = 0; round < ROUNDS; ++round) {
+			res = GTPublicationsFile_getPublishedData(
+					pub, FIRST_IDENT + i * interval, &published_data);
+			if (res != GT_OK) {
+				fprintf(stderr, "%s: %s\n", name, GT_getErrorString(res));
+				goto cleanup;
+			}
+			GTPublishedData_free(published_data);
+		}
+		lookup = (now() - start) / ROUNDS;
+		total += lookup;
+		if (lookup > worst) {
+			worst = lookup;
+		}
+	}
+
+	printf("%-8s %6u publications: decode %6.0f us, lookup %6.0f ns average, "
+			"%8.0f ns worst\n", name, count, decode * 1e6,
+			total / count * 1e9, worst * 1e9);
+
+cleanup:
+	GTPublicationsFile_free(pub);
+	free(data);
+
+	return res;
+}
+
+/**/
+
+int main(void)
+{
+	int res;
+
+	res = GT_init();
+	if (res != GT_OK) {
+		fprintf(stderr, "%s\n", GT_getErrorString(res));
+		return 1;
+	}
+
+	res = run("daily", 10000, 86400);
+	if (res == GT_OK) {
+		res = run("monthly", 10000, 30 * 86400LL);
+	}
+
+	GT_finalize();
+
+	return res == GT_OK ? 0 : 1;
+}
@@ -81,6 +81,41 @@ describe('GuardTime', function(){
     });
   });
 
+  describe('PublicationsFile', function(){
+    it('decodes publications data once and is reused for checks', function(done){
+      var pf = new gt.PublicationsFile(gt.publications.data);
+      assert.equal(pf.getLastPublicationTime().getTime(),
+            TimeSignature.verifyPublications(gt.publications.data).getTime());
+      assert.ok(gt.publications.file instanceof gt.PublicationsFile);
+      assert.equal(sig.checkPublication(pf), gt.VER_RES.PUBLICATION_CHECKED);
+      assert.equal(sig.checkPublication(gt.publications.data), gt.VER_RES.PUBLICATION_CHECKED);
+      assert.throws(function () {
+        new gt.PublicationsFile('blah');
+        }, /Invalid format/i
+      );
+      done();
+    });
+
+    it('rejects cells too small for the publication identifier', function(done){
+      // 10 cells of 1 byte ending at the end of data; identifiers would be read past it
+      var data = new Buffer(36 + 10);
+      data.fill(0);
+      data.writeUInt16BE(1, 0);          // version
+      data.writeUInt32BE(36, 10);        // data block begin
+      data.writeUInt16BE(1, 14);         // publication cell size
+      data.writeUInt32BE(10, 16);        // number of publications
+      data.writeUInt32BE(data.length, 20);  // key hashes begin
+      data.writeUInt16BE(41, 24);        // key hash cell size
+      data.writeUInt32BE(data.length, 28);  // publication reference begin
+      data.writeUInt32BE(data.length, 32);  // signature block begin
+      assert.throws(function () {
+        new gt.PublicationsFile(data);
+        }, /Invalid format/i
+      );
+      done();
+    });
+  });
+
   describe('TimeSignature.getRegisteredTime()', function(){
     it("checks if fresh signature token's signing time is reasonable", function(done){
       var now = new Date();
@@ -93,6 +128,18 @@ describe('GuardTime', function(){
     });
   });
 
+  describe('TimeSignature.verify()', function(){
+    it('returns a fresh properties object on repeated calls', function(done){
+      var p1 = sig.verify();
+      p1.verification_status |= gt.VER_RES.DOCUMENT_HASH_CHECKED;
+      var p2 = sig.verify();
+      assert.equal(p2.verification_status, gt.VER_RES.PUBLIC_KEY_SIGNATURE_PRESENT);
+      assert.equal(p2.registered_time.getTime(), sig.getRegisteredTime().getTime());
+      assert.equal(p2.location_name, sig.getSignerName());
+      done();
+    });
+  });
+
   describe('TimeSignature.getSignerName()', function(){
     it("checks if signer ID namespace starts with GT", function(done){
       assert.ok(sig.getSignerName().match(/^GT :/));
@@ -109,6 +156,22 @@ describe('GuardTime', function(){
         done();
       });
     });
+    it('uses expired publications data while reloading it in background', function(done){
+      var pub = gt.publications, file = pub.file;
+      pub.updatedat = Date.now() - pub.lifetime * 1000 - 1000; // expired, within grace period
+      gt.verify('Hello!', sig, function(err, res){
+        assert.ifError(err);
+        assert.ok(res & gt.VER_RES.PUBLICATION_CHECKED);
+        assert.ok(pub.file === file, "waited for the reload");
+        var timer = setInterval(function(){
+          if (pub.file !== file) {
+            clearInterval(timer);
+            assert.ok(pub.updatedat + pub.lifetime * 1000 > Date.now());
+            done();
+          }
+        }, 10);
+      });
+    });
   });
 
   describe('loadSync()', function(){
@@ -146,6 +209,202 @@ describe('GuardTime', function(){
     });
   });
 
+  describe('TimeSignature.verifyAsync()', function(){
+    it('verifies in thread pool without blocking the event loop', function(done){
+      var n = 200, cntr = 0, ticks = 0;
+      var expected = old.verify();
+      var timer = setInterval(function () { ticks++; }, 0);
+      for (var i = 0; i < n; i++) {
+        old.verifyAsync(function (err, props) {
+          assert.ifError(err);
+          assert.deepEqual(props, expected);
+          if (++cntr == n) {
+            clearInterval(timer);
+            assert.ok(ticks > 0, "event loop was blocked during verification");
+            done();
+          }
+        });
+      }
+    });
+    it('verifies publications and processes errors asynchronously', function(done){
+      TimeSignature.verifyPublicationsAsync(gt.publications.data, function (err, lastpubdate) {
+        assert.ifError(err);
+        assert.equal(lastpubdate.getTime(), gt.publications.last.getTime());
+        sig.checkPublicationAsync(gt.publications.data, function (err, res) {
+          assert.ifError(err);
+          assert.equal(res, gt.VER_RES.PUBLICATION_CHECKED);
+          TimeSignature.processResponseAsync('blah', function (err, der) {
+            assert.ok(err instanceof Error);
+            assert.ok(der === undefined);
+            done();
+          });
+        });
+      });
+    });
+  });
+
+  describe('TimeSignature.verifyBatch()', function(){
+    it('verifies many tokens in one call', function(done){
+      var h = crypto.createHash(gt.default_hashalg);
+      h.update('Hello!');
+      var hash = h.digest();
+      var tokens = [], hashes = [];
+      for (var i = 0; i < 100; i++) {
+        tokens.push(sig.getContent());
+        hashes.push(hash);
+      }
+      tokens.push(sig.getContent());
+      hashes.push(new Buffer(hash.length));
+      tokens.push('blah');
+      hashes.push(hash);
+      TimeSignature.verifyBatch(tokens, hashes, gt.publications.data, function (err, statuses, errors) {
+        assert.ifError(err);
+        assert.equal(statuses.length, tokens.length);
+        for (var i = 0; i < 100; i++) {
+          assert.equal(errors[i], null);
+          assert.equal(statuses[i], gt.VER_RES.PUBLIC_KEY_SIGNATURE_PRESENT +
+                gt.VER_RES.DOCUMENT_HASH_CHECKED + gt.VER_RES.PUBLICATION_CHECKED);
+        }
+        assert.ok(errors[100].match(/different document/));
+        assert.ok(errors[101].match(/Invalid format/i));
+        done();
+      });
+    });
+    it('reuses history chain calculations with the history cache', function(done){
+      var h = crypto.createHash(gt.default_hashalg);
+      h.update('Hello!');
+      var hash = h.digest();
+      var tokens = [], hashes = [];
+      for (var i = 0; i < 10; i++) {
+        tokens.push(sig.getContent());
+        hashes.push(hash);
+      }
+      TimeSignature.setHistoryCacheSize(1024);
+      TimeSignature.verifyBatch(tokens, hashes, gt.publications.data, function (err, statuses, errors) {
+        assert.ifError(err);
+        for (var i = 0; i < tokens.length; i++) {
+          assert.equal(errors[i], null);
+        }
+        var stats = TimeSignature.getHistoryCacheStats();
+        assert.equal(stats.capacity, 1024);
+        assert.equal(stats.hits + stats.misses, tokens.length);
+        assert.ok(stats.hits > 0);
+        TimeSignature.setHistoryCacheSize(0);
+        assert.equal(TimeSignature.getHistoryCacheStats().capacity, 0);
+        assert.throws(function () {
+          TimeSignature.setHistoryCacheSize(NaN);
+        }, /TypeError/);
+        assert.throws(function () {
+          TimeSignature.setHistoryCacheSize(Infinity);
+        }, /TypeError/);
+        done();
+      });
+    });
+  });
+
+  describe('TimeSignature.cache', function(){
+    it('returns cached verification results', function(done){
+      TimeSignature.cache.configure({capacity: 100, ttl: 60});
+      TimeSignature.cache.clear();
+      var first = new TimeSignature(old.getContent()).verify();
+      var second = new TimeSignature(old.getContent()).verify();
+      assert.deepEqual(second, first);
+      var stats = TimeSignature.cache.stats();
+      assert.equal(stats.capacity, 100);
+      assert.equal(stats.ttl, 60);
+      assert.equal(stats.hits, 1);
+      assert.equal(stats.entries, 1);
+      TimeSignature.cache.configure({capacity: 0});
+      assert.equal(TimeSignature.cache.stats().entries, 0);
+      assert.throws(function () {
+        TimeSignature.cache.configure({capacity: NaN});
+      }, /TypeError/);
+      assert.throws(function () {
+        TimeSignature.cache.configure({ttl: Infinity});
+      }, /TypeError/);
+      done();
+    });
+    it('counts batch results for another document as misses', function(done){
+      var hash = crypto.createHash(gt.default_hashalg).update('Hello!').digest();
+      var other = new Buffer(hash.length);
+      other.fill(0);
+      TimeSignature.cache.configure({capacity: 100});
+      TimeSignature.cache.clear();
+      TimeSignature.verifyBatch([sig.getContent()], [hash], gt.publications.data, function (err, statuses, errors) {
+        assert.ifError(err);
+        TimeSignature.verifyBatch([sig.getContent()], [other], gt.publications.data, function (err, statuses, errors) {
+          assert.ifError(err);
+          assert.ok(errors[0].match(/different document/));
+          TimeSignature.verifyBatch([sig.getContent()], [hash], gt.publications.data, function (err, statuses, errors) {
+            assert.ifError(err);
+            assert.equal(errors[0], null);
+            var stats = TimeSignature.cache.stats();
+            assert.equal(stats.hits, 1);
+            assert.equal(stats.misses, 2);
+            TimeSignature.cache.configure({capacity: 0});
+            done();
+          });
+        });
+      });
+    });
+  });
+
+  describe('PublicationsFile.load()', function(){
+    it('maps publications file from disk', function(done){
+      var fs = require('fs'), path = require('os').tmpdir() + '/gt-publications-' + process.pid + '.bin';
+      fs.writeFileSync(path, gt.publications.data);
+      var pf = gt.PublicationsFile.load(path);
+      assert.equal(pf.getLastPublicationTime().getTime(), gt.publications.file.getLastPublicationTime().getTime());
+      assert.equal(old.checkPublication(pf), gt.VER_RES.PUBLICATION_CHECKED);
+      fs.unlinkSync(path);
+      assert.throws(function () {
+        gt.PublicationsFile.load(path + '.missing');
+      }, /I\/O error/);
+      done();
+    });
+  });
+
+  describe('PublicationsFile.setVerificationCacheFile()', function(){
+    it('records verified publications files', function(done){
+      var fs = require('fs'), path = require('os').tmpdir() + '/gt-verified-' + process.pid + '.txt';
+      var data = gt.publications.data;
+      var digest = require('crypto').createHash('sha256')
+          .update(Buffer.isBuffer(data) ? data : new Buffer(data, 'binary')).digest('hex');
+      if (fs.existsSync(path))
+        fs.unlinkSync(path);
+      // setting the file forgets earlier verifications, so this one is recorded
+      gt.PublicationsFile.setVerificationCacheFile(path);
+      var pf = new gt.PublicationsFile(data);
+      assert.equal(old.checkPublication(pf), gt.VER_RES.PUBLICATION_CHECKED);
+      var lines = fs.readFileSync(path, 'utf8').split('\n');
+      assert.equal(lines.length, 2);
+      assert.ok(new RegExp('^' + digest + ' [0-9]+$').test(lines[0]), lines[0]);
+      // found in memory, then in the file; not recorded again
+      new gt.PublicationsFile(data);
+      gt.PublicationsFile.setVerificationCacheFile(path);
+      new gt.PublicationsFile(data);
+      assert.equal(fs.readFileSync(path, 'utf8'), lines.join('\n'));
+      gt.PublicationsFile.setVerificationCacheFile(null);
+      fs.unlinkSync(path);
+      assert.throws(function () {
+        gt.PublicationsFile.setVerificationCacheFile(1);
+      }, /TypeError/);
+      done();
+    });
+  });
+
+  describe('TimeSignature.getMetadata()', function(){
+    it('extracts token properties without verification', function(done){
+      var meta = old.getMetadata(), props = old.verify();
+      assert.equal(meta.registered_time.getTime(), props.registered_time.getTime());
+      assert.equal(meta.location_id, props.location_id);
+      assert.equal(meta.location_name, props.location_name);
+      assert.equal(meta.hash_algorithm, props.hash_algorithm);
+      assert.ok(meta.publication_time.getTime() >= meta.registered_time.getTime());
+      done();
+    });
+  });
+
   describe('TimeSignature.checks()', function(){
     it('tests TimeSignature parameter checks', function(done){
       assert.throws(function () {
@@ -207,11 +466,158 @@ describe('GuardTime', function(){
     it('changes service configuration', function(done){
       gt.conf(newconf);
       assert.equal(gt.service.signer.method, 'POST');
-      assert.equal(gt.service.verifier.agent.maxSockets, newconf.verifierthreads);
+      assert.equal(gt.service.verifier.maxinflight, newconf.verifierthreads);
       done();
     });
   });
 
+  describe('transport', function(){
+    it('keeps connections alive and limits requests in flight', function(done){
+      var transport = require('../transport'), http = require('http');
+      var connections = 0, active = 0, maxactive = 0;
+      var server = http.createServer(function(req, res){
+        maxactive = Math.max(maxactive, ++active);
+        req.on('data', function(){});
+        req.on('end', function(){
+          setTimeout(function(){ active--; res.end(req.url); }, 5);
+        });
+      });
+      server.on('connection', function(){ connections++; });
+      server.listen(0, '127.0.0.1', function(){
+        var where = { hostname: '127.0.0.1', port: server.address().port,
+                      path: '/gt-signingservice', method: 'POST', maxinflight: 2 };
+        var n = 20, cntr = 0;
+        for (var i = 0; i < n; i++) {
+          transport.request(where, 'request', function(err, res){
+            assert.ifError(err);
+            assert.equal(res.body.toString(), '/gt-signingservice');
+            if (++cntr == n) {
+              assert.equal(maxactive, 2);
+              assert.equal(connections, 2);
+              server.close();
+              done();
+            }
+          });
+        }
+      });
+    });
+
+    it('does not allocate bodies of announced length up front', function(done){
+      var transport = require('../transport'), net = require('net');
+      var big = new Buffer(200 * 1024);
+      big.fill(7);
+      var server = net.createServer(function(socket){
+        socket.once('data', function(data){
+          if (/^POST \/huge /.test(data.toString('binary'))) {
+            // announces 2 GB, sends a few bytes and closes
+            socket.end('HTTP/1.1 200 OK\r\nContent-Length: 2000000000\r\n\r\nshort');
+          } else {
+            socket.end(Buffer.concat([new Buffer('HTTP/1.1 200 OK\r\nContent-Length: ' +
+                big.length + '\r\nConnection: close\r\n\r\n'), big]));
+          }
+        });
+      });
+      server.listen(0, '127.0.0.1', function(){
+        var where = { hostname: '127.0.0.1', port: server.address().port, method: 'POST' };
+        where.path = '/huge';
+        transport.request(where, 'request', function(err, res){
+          assert.ok(err, 'truncated response accepted');
+          where.path = '/big';
+          transport.request(where, 'request', function(err, res){
+            assert.ifError(err);
+            assert.equal(res.body.length, big.length);
+            assert.equal(res.body.toString('hex'), big.toString('hex'));
+            server.close();
+            done();
+          });
+        });
+      });
+    });
+  });
+
+  describe('signHash() with several gateways', function(){
+    it('sends hedged request to another gateway if the first one is slow', function(done){
+      var http = require('http'), url = require('url');
+      var signer = gt.service.signer.href;
+      // stand-in gateway forwarding requests to the real one after delay
+      function gateway(delay){
+        var server = http.createServer(function(req, res){
+          var body = [];
+          server.hits++;
+          req.on('data', function(chunk){ body.push(chunk); });
+          req.on('end', function(){
+            setTimeout(function(){
+              var upstream = addprops(url.parse(signer), { method: 'POST' });
+              http.request(upstream, function(ures){ ures.pipe(res); }).end(Buffer.concat(body));
+            }, delay);
+          });
+        });
+        server.hits = 0;
+        return server;
+      }
+      function addprops(a, p){ for (var k in p) a[k] = p[k]; return a; }
+      var slow = gateway(5000), fast = gateway(0);
+      slow.listen(0, '127.0.0.1', function(){ fast.listen(0, '127.0.0.1', function(){
+        gt.conf({ signeruri: ['http://127.0.0.1:' + slow.address().port + '/gt-signingservice',
+                              'http://127.0.0.1:' + fast.address().port + '/gt-signingservice'] });
+        gt.service.signer.latencies = [100, 100, 100, 100, 100, 100, 100, 100];
+        gt.signHash(crypto.createHash('sha256').update('Hello!').digest(), 'SHA256', function(err, ts){
+          assert.ifError(err);
+          assert.ok(ts instanceof TimeSignature);
+          assert.equal(slow.hits, 1);
+          assert.equal(fast.hits, 1);
+          gt.conf({ signeruri: signer });
+          slow.close();
+          fast.close();
+          done();
+        });
+      }); });
+    });
+  });
+
+  describe('extendQueued()', function(){
+    it('extends a token once and keeps it in the extension store', function(done){
+      var stored = {}, sets = 0, cntr = 0;
+      gt.conf({ extensionstore: {
+        get: function(key, cb){ cb(null, stored[key]); },
+        set: function(key, der, cb){ sets++; stored[key] = der; cb(); }
+      } });
+      [gt.loadSync(testsigfile), gt.loadSync(testsigfile)].forEach(function(ts){
+        gt.extendQueued(ts, function(err, xts){
+          assert.ifError(err);
+          assert.ok(xts.isExtended());
+          if (++cntr < 2)
+            return;
+          assert.equal(Object.keys(stored).length, 1);
+          gt.extendQueued(gt.loadSync(testsigfile), function(err, xts){
+            assert.ifError(err);
+            assert.ok(xts.isExtended());
+            assert.equal(sets, 2, "extended again instead of using the store");
+            gt.conf({ extensionstore: null });
+            done();
+          });
+        });
+      });
+    });
+
+    it('reuses extending responses of the same round', function(done){
+      gt.loadPublications(function(err){
+        assert.ifError(err);
+        gt.extendQueued(gt.loadSync(testsigfile), function(err, xts){
+          assert.ifError(err);
+          var before = gt.getExtensionCacheStats();
+          assert.ok(before.entries > 0);
+          gt.extendQueued(gt.loadSync(testsigfile), function(err, xts){
+            assert.ifError(err);
+            assert.ok(xts.isExtended());
+            assert.equal(gt.getExtensionCacheStats().hits, before.hits + 1);
+            done();
+          });
+        });
+      });
+    });
+  });
+
   describe('verifyFile() etc', function(){
     it('test_verifying_old_stuff_with_pub_dl', function(done){
       gt.publications.updatedat = 0;
@@ -280,4 +686,43 @@ describe('GuardTime', function(){
       });
     });
   });
+
+  describe('TimeSignature.aggregateHashes()', function(){
+    it('links every hash to the root of the tree', function(){
+      var hashes = [];
+      for (var i = 0; i < 5; i++)
+        hashes.push(crypto.createHash('sha256').update('leaf ' + i).digest());
+      var tree = TimeSignature.aggregateHashes(hashes, 'sha256');
+      assert.equal(tree.chains.length, hashes.length);
+      hashes.forEach(function(h, i){
+        assert.equal(TimeSignature.aggregationRoot(tree.chains[i], h).toString('hex'), tree.root.toString('hex'));
+      });
+      var other = crypto.createHash('sha256').update('not a leaf').digest();
+      assert.notEqual(TimeSignature.aggregationRoot(tree.chains[0], other).toString('hex'), tree.root.toString('hex'));
+    });
+  });
+
+  describe('signHash() with aggregation', function(){
+    it('signs multiple hashes with a single request', function(done){
+      gt.conf({aggregationwindow: 50});
+      var cntr = 0, tokens = [];
+      ['one', 'two', 'three'].forEach(function(data){
+        var hd = crypto.createHash('sha256').update(data).digest();
+        gt.signHash(hd, 'sha256', function (err, ts, chain) {
+          assert.ifError(err);
+          assert.ok(ts instanceof TimeSignature, 'signing did not return an instance of TimeSignature');
+          tokens.push(ts.getContent().toString('hex'));
+          gt.verifyHash(hd, 'sha256', ts, chain, function (err, res) {
+            assert.ifError(err);
+            assert.ok(res & gt.VER_RES.DOCUMENT_HASH_CHECKED);
+            if (++cntr == 3) {
+              gt.conf({aggregationwindow: 0});
+              assert.equal(tokens[0], tokens[2], 'hashes were not signed together');
+              done();
+            }
+          });
+        });
+      });
+    });
+  });
 });
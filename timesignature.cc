@@ -21,10 +21,17 @@
 #include <node_object_wrap.h>
 
 #include <nan.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <list>
+#include <map>
 #include <string>
+#include <vector>
 
 #include <openssl/crypto.h>
 #include <openssl/opensslv.h>
+#include <openssl/sha.h>
 
 #if !(defined OPENSSL_CA_FILE || defined OPENSSL_CA_DIR || defined PREINSTALLED_LIBGT)
   const char* root_certs[] = {
@@ -80,6 +87,11 @@
     return NanThrowError("TimeSignature is blank"); \
   }
 
+#define ASSERT_IS_FUNCTION(val) \
+  if (!(val)->IsFunction()) { \
+    return NanThrowTypeError("Callback must be a function"); \
+  }
+
 #define ASSERT_GT_ERROR(res) \
   if ((res) != GT_OK) { \
     return NanThrowError(GT_getErrorString(res)); \
@@ -90,10 +102,420 @@ using namespace node;
 using namespace v8;
 
 
+// true for numbers other than NaN and the infinities, like isFinite() in JS
+static bool isFiniteNumber(Local<Value> value)
+{
+  return value->IsNumber() && value->NumberValue() - value->NumberValue() == 0;
+}
+
+// Result of a successful token verification: status and the token properties
+// returned by verify(). Unlike GTVerificationInfo it can be copied, so that
+// results can be shared between threads through VerificationCache.
+struct VerificationResult
+{
+  int verification_status;
+  GT_UInt64 location_id;
+  GT_Time_t64 registered_time;
+  int hash_algorithm;
+  GT_Time_t64 publication_identifier;
+  // optional strings are present if the has_ flag is set
+  std::string location_name;
+  std::string policy;
+  std::string hash_value;
+  std::string issuer_name;
+  std::string public_key_fingerprint;
+  std::string publication_string;
+  bool has_location_name;
+  bool has_policy;
+  bool has_hash_value;
+  bool has_issuer_name;
+  bool has_public_key_fingerprint;
+  bool has_publication_string;
+  std::vector<std::string> pub_references;
+
+  VerificationResult()
+    : verification_status(0), location_id(0), registered_time(0), hash_algorithm(-1),
+      publication_identifier(0), has_location_name(false), has_policy(false),
+      has_hash_value(false), has_issuer_name(false), has_public_key_fingerprint(false),
+      has_publication_string(false) {}
+
+  // explicit data is only present if parsing was requested from GTTimestamp_verify()
+  void set(const GTVerificationInfo *info)
+  {
+    verification_status = info->verification_status;
+    location_id = info->implicit_data->location_id;
+    registered_time = info->implicit_data->registered_time;
+    setString(&location_name, &has_location_name, info->implicit_data->location_name);
+    setString(&public_key_fingerprint, &has_public_key_fingerprint,
+        info->implicit_data->public_key_fingerprint);
+    setString(&publication_string, &has_publication_string, info->implicit_data->publication_string);
+    if (info->explicit_data != NULL) {
+      hash_algorithm = info->explicit_data->hash_algorithm;
+      publication_identifier = info->explicit_data->publication_identifier;
+      setString(&policy, &has_policy, info->explicit_data->policy);
+      setString(&hash_value, &has_hash_value, info->explicit_data->hash_value);
+      setString(&issuer_name, &has_issuer_name, info->explicit_data->issuer_name);
+      pub_references.clear();
+      for (int i = 0; i < info->explicit_data->pub_reference_count; i++)
+        pub_references.push_back(info->explicit_data->pub_reference_list[i]);
+    }
+  }
+
+private:
+  static void setString(std::string *value, bool *has_value, const char *s)
+  {
+    *has_value = (s != NULL);
+    value->assign(s != NULL ? s : "");
+  }
+};
+
+
+// Process-wide LRU cache of successful verifications, see TimeSignature.cache.
+// Keys are made of the digests of the token and of the publications file, so a
+// hit skips decoding and all cryptographic checks. Used from worker threads too.
+class VerificationCache
+{
+public:
+  // what was verified; part of the key
+  enum Kind {
+    VERIFY = 'v',       // verify(): syntax, hash chains and signature of the token
+    PUBLICATION = 'p',  // checkPublication() against a publications file
+    BATCH = 'b'         // verifyBatch(): all of the above and the document hash
+  };
+
+  struct Entry
+  {
+    VerificationResult result;
+    // BATCH: the document hash that was checked
+    std::string document_hash;
+    // uv_hrtime() in ms when the entry expires, 0 if never
+    uint64_t expires;
+
+    Entry() : expires(0) {}
+  };
+
+  static void Init()
+  {
+    uv_mutex_init(&lock);
+  }
+
+  // pub_digest is NULL for VERIFY
+  static std::string makeKey(Kind kind, const unsigned char *token_digest,
+      const unsigned char *pub_digest)
+  {
+    std::string key(1, (char) kind);
+    key.append((const char *) token_digest, SHA256_DIGEST_LENGTH);
+    if (pub_digest != NULL)
+      key.append((const char *) pub_digest, SHA256_DIGEST_LENGTH);
+    return key;
+  }
+
+  // read without the lock, so that verifications do not contend for it while
+  // the cache is disabled; lookup() and insert() check again under the lock
+  static bool enabled()
+  {
+    return enabled_flag != 0;
+  }
+
+  // copies the entry to *entry if found and not expired; for BATCH, an entry
+  // for another document_hash is a miss
+  static bool lookup(const std::string &key, Entry *entry = NULL,
+      const std::string *document_hash = NULL)
+  {
+    bool found = false;
+    uv_mutex_lock(&lock);
+    std::map<std::string, List::iterator>::iterator i = index.find(key);
+    if (i != index.end()) {
+      if (i->second->second.expires != 0 && i->second->second.expires < now()) {
+        lru.erase(i->second);
+        index.erase(i);
+        expirations++;
+      } else if (document_hash == NULL || i->second->second.document_hash == *document_hash) {
+        // most recently used first
+        lru.splice(lru.begin(), lru, i->second);
+        if (entry != NULL)
+          *entry = i->second->second;
+        found = true;
+      }
+    }
+    if (found)
+      hits++;
+    else
+      misses++;
+    uv_mutex_unlock(&lock);
+    return found;
+  }
+
+  static void insert(const std::string &key, const Entry &entry)
+  {
+    uv_mutex_lock(&lock);
+    if (capacity > 0) {
+      std::map<std::string, List::iterator>::iterator i = index.find(key);
+      if (i != index.end()) {
+        lru.erase(i->second);
+        index.erase(i);
+      }
+      lru.push_front(std::make_pair(key, entry));
+      lru.front().second.expires = (ttl > 0) ? now() + ttl : 0;
+      index[key] = lru.begin();
+      trim();
+    }
+    uv_mutex_unlock(&lock);
+  }
+
+  // capacity in entries, 0 disables the cache; ttl in ms, 0 for no expiry
+  static void configure(size_t new_capacity, uint64_t new_ttl)
+  {
+    uv_mutex_lock(&lock);
+    capacity = new_capacity;
+    enabled_flag = capacity > 0;
+    ttl = new_ttl;
+    trim();
+    uv_mutex_unlock(&lock);
+  }
+
+  static void clear()
+  {
+    uv_mutex_lock(&lock);
+    lru.clear();
+    index.clear();
+    hits = misses = evictions = expirations = 0;
+    uv_mutex_unlock(&lock);
+  }
+
+  static Local<Object> statsAsObject()
+  {
+    Local<Object> result = NanNew<Object>();
+    uv_mutex_lock(&lock);
+    result->Set(NanNew<String>("capacity"), NanNew<Number>(capacity));
+    result->Set(NanNew<String>("ttl"), NanNew<Number>(ttl / 1000.0));
+    result->Set(NanNew<String>("entries"), NanNew<Number>(index.size()));
+    result->Set(NanNew<String>("hits"), NanNew<Number>(hits));
+    result->Set(NanNew<String>("misses"), NanNew<Number>(misses));
+    result->Set(NanNew<String>("evictions"), NanNew<Number>(evictions));
+    result->Set(NanNew<String>("expirations"), NanNew<Number>(expirations));
+    uv_mutex_unlock(&lock);
+    return result;
+  }
+
+private:
+  typedef std::list<std::pair<std::string, Entry> > List;
+
+  static uv_mutex_t lock;
+  static List lru;
+  static std::map<std::string, List::iterator> index;
+  static size_t capacity;
+  static volatile int enabled_flag;
+  static uint64_t ttl;
+  static double hits;
+  static double misses;
+  static double evictions;
+  static double expirations;
+
+  static uint64_t now()
+  {
+    return uv_hrtime() / 1000000;
+  }
+
+  // lock must be held
+  static void trim()
+  {
+    while (index.size() > capacity) {
+      index.erase(lru.back().first);
+      lru.pop_back();
+      evictions++;
+    }
+  }
+};
+
+uv_mutex_t VerificationCache::lock;
+VerificationCache::List VerificationCache::lru;
+std::map<std::string, VerificationCache::List::iterator> VerificationCache::index;
+size_t VerificationCache::capacity = 0;
+volatile int VerificationCache::enabled_flag = 0;
+uint64_t VerificationCache::ttl = 0;
+double VerificationCache::hits = 0;
+double VerificationCache::misses = 0;
+double VerificationCache::evictions = 0;
+double VerificationCache::expirations = 0;
+
+
+// Decoded and verified publications file, to be reused across verifications.
+class PublicationsFile: public ObjectWrap
+{
+public:
+  GTPublicationsFile *pub;
+  GT_Time_t64 last_publication_time;
+  // SHA-256 of the DER content, identifies the file in VerificationCache keys
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  // Buffer whose contents pub borrows, if any
+  Persistent<Object> buffer;
+
+  static Persistent<FunctionTemplate> constructor_template;
+
+  static void Init(Handle<Object> target)
+  {
+    NanScope();
+
+    Local<FunctionTemplate> t = NanNew<FunctionTemplate>(New);
+    NanAssignPersistent(constructor_template, t);
+    t->InstanceTemplate()->SetInternalFieldCount(1);
+    t->SetClassName(NanNew<String>("PublicationsFile"));
+
+    NODE_SET_PROTOTYPE_METHOD(t, "getLastPublicationTime", GetLastPublicationTime);
+
+    NODE_SET_METHOD(t, "load", Load);
+    NODE_SET_METHOD(t, "setVerificationCacheFile", SetVerificationCacheFile);
+
+    target->Set(NanNew("PublicationsFile"), t->GetFunction());
+  }
+
+  PublicationsFile(GTPublicationsFile *p, GT_Time_t64 last)
+  {
+    pub = p;
+    last_publication_time = last;
+    const void *data;
+    size_t data_length;
+    GTPublicationsFile_getData(pub, &data, &data_length);
+    SHA256((const unsigned char *) data, data_length, digest);
+  }
+
+  ~PublicationsFile()
+  {
+    // pub may point into the buffer
+    if (pub != NULL)
+      GTPublicationsFile_free(pub);
+    NanDisposePersistent(buffer);
+  }
+
+  // new PublicationsFile(der_publications_file_content); throws if signature does not verify.
+  // Buffer content is used in place and must not be modified afterwards.
+  static NAN_METHOD(New)
+  {
+    NanScope();
+    GTPublicationsFile *pub;
+    int res;
+
+    if (!args.IsConstructCall())
+      return NanThrowError("Please use 'new' to instantiate a PublicationsFile class");
+
+    ASSERT_IS_N_ARGS(1);
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+
+    ssize_t len = DecodeBytes(args[0], BINARY);
+    ASSERT_IS_POSITIVE(len);
+    bool borrowed = Buffer::HasInstance(args[0]);
+    if (borrowed) {
+      Local<Object> buffer_obj = args[0]->ToObject();
+      res = GTPublicationsFile_DERDecodeBorrowed(Buffer::Data(buffer_obj), len, &pub);
+    } else {
+      char* buf = new char[len];
+      ssize_t written = DecodeWrite(buf, len, args[0], BINARY);
+      assert(written == len);
+      res = GTPublicationsFile_DERDecode(buf, len, &pub);
+      delete [] buf;
+    }
+    ASSERT_GT_ERROR(res);
+
+    PublicationsFile *pf;
+    const char *err = create(pub, &pf);
+    if (err != NULL)
+      return NanThrowError(err);
+    if (borrowed)
+      NanAssignPersistent(pf->buffer, args[0]->ToObject());
+    pf->Wrap(args.This());
+    NanReturnValue(args.This());
+  }
+
+  // PublicationsFile.load(path) -> PublicationsFile; throws if signature does not verify.
+  // The file is memory mapped, so processes loading the same file share its pages.
+  static NAN_METHOD(Load)
+  {
+    NanScope();
+
+    ASSERT_IS_N_ARGS(1);
+    if (!args[0]->IsString()) {
+      return NanThrowTypeError("File name must be a string");
+    }
+
+    GTPublicationsFile *pub;
+    int res = GTPublicationsFile_loadMapped(*String::Utf8Value(args[0]), &pub);
+    if (res == GT_IO_ERROR)
+      return NanThrowError(NanNew<String>((std::string(GT_getErrorString(res)) + ": " +
+            strerror(errno)).c_str()));
+    ASSERT_GT_ERROR(res);
+
+    PublicationsFile *pf;
+    const char *err = create(pub, &pf);
+    if (err != NULL)
+      return NanThrowError(err);
+    // instance without calling New
+    Local<Object> obj = NanNew(constructor_template)->InstanceTemplate()->NewInstance();
+    pf->Wrap(obj);
+    NanReturnValue(obj);
+  }
+
+  // PublicationsFile.setVerificationCacheFile(path | null)
+  // Verified files are recorded in the file and accepted without checking the signature
+  // again, also by other processes using the same file.
+  static NAN_METHOD(SetVerificationCacheFile)
+  {
+    NanScope();
+
+    ASSERT_IS_N_ARGS(1);
+    int res;
+    if (args[0]->IsNull()) {
+      res = GTPublicationsFile_setVerificationCacheFile(NULL);
+    } else if (args[0]->IsString()) {
+      res = GTPublicationsFile_setVerificationCacheFile(*String::Utf8Value(args[0]));
+    } else {
+      return NanThrowTypeError("File name must be a string or null");
+    }
+    ASSERT_GT_ERROR(res);
+    NanReturnUndefined();
+  }
+
+  static NAN_METHOD(GetLastPublicationTime)
+  {
+    NanScope();
+    PublicationsFile *pf = ObjectWrap::Unwrap<PublicationsFile>(args.This());
+    NanReturnValue(NODE_UNIXTIME_V8((double) pf->last_publication_time));
+  }
+
+  static bool HasInstance(Handle<Value> val) {
+    if (!val->IsObject()) return false;
+    Local<Object> obj = val->ToObject();
+    return NanHasInstance(constructor_template, obj);
+  }
+
+private:
+  // verifies the signature of pub and takes it over; frees pub on failure.
+  // returns NULL if ok, error message otherwise
+  static const char *create(GTPublicationsFile *pub, PublicationsFile **result)
+  {
+    GTPubFileVerificationInfo *vi;
+    int res = GTPublicationsFile_verify(pub, &vi);
+    if (res != GT_OK) {
+      GTPublicationsFile_free(pub);
+      return GT_getErrorString(res);
+    }
+    GT_Time_t64 last = vi->last_publication_time;
+    GTPubFileVerificationInfo_free(vi);
+
+    *result = new PublicationsFile(pub, last);
+    return NULL;
+  }
+};
+
+Persistent<FunctionTemplate> PublicationsFile::constructor_template;
+
+
 class TimeSignature: public ObjectWrap
 {
 private:
   GTTimestamp *timestamp;
+  // memoized verification result; token does not change until extend()
+  VerificationResult *verification_result;
 
 public:
   static Persistent<FunctionTemplate> constructor_template;
@@ -118,28 +540,52 @@ public:
     NODE_SET_PROTOTYPE_METHOD(t, "extend", Extend);
     NODE_SET_PROTOTYPE_METHOD(t, "isEarlierThan", IsEarlierThan);
     NODE_SET_PROTOTYPE_METHOD(t, "getRegisteredTime", GetRegisteredTime);
+    NODE_SET_PROTOTYPE_METHOD(t, "getMetadata", GetMetadata);
+    NODE_SET_PROTOTYPE_METHOD(t, "verifyAsync", VerifyAsync);
+    NODE_SET_PROTOTYPE_METHOD(t, "checkPublicationAsync", CheckPublicationAsync);
+    NODE_SET_PROTOTYPE_METHOD(t, "extendAsync", ExtendAsync);
 
     NODE_SET_METHOD(t, "composeRequest", ComposeRequest);
     NODE_SET_METHOD(t, "processResponse", ProcessResponse);
     NODE_SET_METHOD(t, "verifyPublications", VerifyPublications);
-
-    target->Set(NanNew("TimeSignature"), t->GetFunction());
+    NODE_SET_METHOD(t, "processResponseAsync", ProcessResponseAsync);
+    NODE_SET_METHOD(t, "verifyPublicationsAsync", VerifyPublicationsAsync);
+    NODE_SET_METHOD(t, "verifyBatch", VerifyBatch);
+    NODE_SET_METHOD(t, "aggregateHashes", AggregateHashes);
+    NODE_SET_METHOD(t, "aggregationRoot", AggregationRoot);
+    NODE_SET_METHOD(t, "setHistoryCacheSize", SetHistoryCacheSize);
+    NODE_SET_METHOD(t, "getHistoryCacheStats", GetHistoryCacheStats);
+
+    Local<Function> f = t->GetFunction();
+    Local<Object> cache = NanNew<Object>();
+    NODE_SET_METHOD(cache, "configure", ConfigureCache);
+    NODE_SET_METHOD(cache, "stats", GetCacheStats);
+    NODE_SET_METHOD(cache, "clear", ClearCache);
+    f->Set(NanNew("cache"), cache);
+
+    target->Set(NanNew("TimeSignature"), f);
   }
 
   TimeSignature()
   {
     timestamp = NULL;
+    verification_result = NULL;
+    pending = 0;
   }
 
   TimeSignature(GTTimestamp *ts)
   {
     timestamp = ts;
+    verification_result = NULL;
+    pending = 0;
   }
 
   ~TimeSignature()
   {
     if(timestamp != NULL)
       GTTimestamp_free(timestamp);
+    delete verification_result;
+    freeRetired();
   }
 
   static NAN_METHOD(New)
@@ -176,6 +622,17 @@ public:
     NanReturnValue(args.This());
   }
 
+  static void freeGTBuffer(char *data, void *hint)
+  {
+    GT_free(data);
+  }
+
+  // wraps GT_malloc()-ed data into a Buffer without copying; takes ownership of data
+  static Local<Object> newGTBuffer(unsigned char *data, size_t length)
+  {
+    return NanNewBufferHandle((char *)data, length, freeGTBuffer, NULL);
+  }
+
   static Local<String> format_location_id(GT_UInt64 l)
   {
     char buf[32];
@@ -205,54 +662,54 @@ public:
     }    
   }
 
-  // no arguments, just syntax check
-  static NAN_METHOD(Verify)
+  static Local<Object> verification_result_as_Object(const VerificationResult *verification_result)
   {
-    NanScope();
-    UNWRAP_ts();
-
-    GTVerificationInfo *verification_info = NULL;
-    int res = GTTimestamp_verify(ts->timestamp, 1, &verification_info);
-    ASSERT_GT_ERROR(res);
-
-    if (verification_info->verification_errors != GT_NO_FAILURES) {
-        GTVerificationInfo_free(verification_info);
-        return NanThrowError("TimeSignature verification error");
-    }
-
     Local<Object> result = NanNew<Object>();
-    result->Set(NanNew<String>("verification_status"), NanNew<Integer>(verification_info->verification_status));
-    result->Set(NanNew<String>("location_id"), format_location_id(verification_info->implicit_data->location_id));
-    if (verification_info->implicit_data->location_name != NULL)
-      result->Set(NanNew<String>("location_name"), NanNew<String>(verification_info->implicit_data->location_name));
-    result->Set(NanNew<String>("registered_time"), NODE_UNIXTIME_V8(verification_info->implicit_data->registered_time));
-
-    if (verification_info->explicit_data->policy != NULL)
-      result->Set(NanNew<String>("policy"), NanNew<String>(verification_info->explicit_data->policy));
-    result->Set(NanNew<String>("hash_algorithm"), hash_algorithm_name_as_String(verification_info->explicit_data->hash_algorithm));
-    if (verification_info->explicit_data->hash_value != NULL)
-      result->Set(NanNew<String>("hash_value"), NanNew<String>(verification_info->explicit_data->hash_value));
-    if (verification_info->explicit_data->issuer_name != NULL)
-      result->Set(NanNew<String>("issuer_name"), NanNew<String>(verification_info->explicit_data->issuer_name));
+    result->Set(NanNew<String>("verification_status"), NanNew<Integer>(verification_result->verification_status));
+    result->Set(NanNew<String>("location_id"), format_location_id(verification_result->location_id));
+    if (verification_result->has_location_name)
+      result->Set(NanNew<String>("location_name"), NanNew<String>(verification_result->location_name.c_str()));
+    result->Set(NanNew<String>("registered_time"), NODE_UNIXTIME_V8(verification_result->registered_time));
+
+    if (verification_result->has_policy)
+      result->Set(NanNew<String>("policy"), NanNew<String>(verification_result->policy.c_str()));
+    result->Set(NanNew<String>("hash_algorithm"), hash_algorithm_name_as_String(verification_result->hash_algorithm));
+    if (verification_result->has_hash_value)
+      result->Set(NanNew<String>("hash_value"), NanNew<String>(verification_result->hash_value.c_str()));
+    if (verification_result->has_issuer_name)
+      result->Set(NanNew<String>("issuer_name"), NanNew<String>(verification_result->issuer_name.c_str()));
 
     // not extended:
-    if (verification_info->implicit_data->public_key_fingerprint != NULL)
-      result->Set(NanNew<String>("public_key_fingerprint"), NanNew<String>(verification_info->implicit_data->public_key_fingerprint));
+    if (verification_result->has_public_key_fingerprint)
+      result->Set(NanNew<String>("public_key_fingerprint"), NanNew<String>(verification_result->public_key_fingerprint.c_str()));
 
     // extended:
-    if (verification_info->implicit_data->publication_string != NULL) {
-      result->Set(NanNew<String>("publication_string"), NanNew<String>(verification_info->implicit_data->publication_string));
-      result->Set(NanNew<String>("publication_identifier"), NanNew<Number>(verification_info->explicit_data->publication_identifier));
-      result->Set(NanNew<String>("publication_time"), NODE_UNIXTIME_V8(verification_info->explicit_data->publication_identifier));
-
-      Handle<Array> refarr = NanNew<Array>(verification_info->explicit_data->pub_reference_count);
-      for (int i = 0; i < verification_info->explicit_data->pub_reference_count; i++)
-        refarr->Set(i, NanNew<String>(verification_info->explicit_data->pub_reference_list[i]));
+    if (verification_result->has_publication_string) {
+      result->Set(NanNew<String>("publication_string"), NanNew<String>(verification_result->publication_string.c_str()));
+      result->Set(NanNew<String>("publication_identifier"), NanNew<Number>(verification_result->publication_identifier));
+      result->Set(NanNew<String>("publication_time"), NODE_UNIXTIME_V8(verification_result->publication_identifier));
+
+      size_t n = verification_result->pub_references.size();
+      Handle<Array> refarr = NanNew<Array>(n);
+      for (size_t i = 0; i < n; i++)
+        refarr->Set(i, NanNew<String>(verification_result->pub_references[i].c_str()));
       result->Set(NanNew<String>("pub_reference_list"), refarr);
     }
+    return result;
+  }
 
-    GTVerificationInfo_free(verification_info);
-    NanReturnValue(result);
+  // no arguments, just syntax check
+  static NAN_METHOD(Verify)
+  {
+    NanScope();
+    UNWRAP_ts();
+
+    const VerificationResult *verification_result;
+    const char *err = ts->getVerificationResult(&verification_result);
+    if (err != NULL)
+      return NanThrowError(err);
+
+    NanReturnValue(verification_result_as_Object(verification_result));
   }
 
 
@@ -291,18 +748,35 @@ public:
     NanScope();
     UNWRAP_ts();
 
-    GTVerificationInfo *verification_info = NULL;
-    int res = GTTimestamp_verify(ts->timestamp, 0, &verification_info);
-    ASSERT_GT_ERROR(res);
+    const VerificationResult *verification_result;
+    const char *err = ts->getVerificationResult(&verification_result);
+    if (err != NULL)
+      return NanThrowError(err);
 
-    if (verification_info->verification_errors != GT_NO_FAILURES) {
-      GTVerificationInfo_free(verification_info);
-      return NanThrowError("TimeSignature verification error");
-    }
+    NanReturnValue(NODE_UNIXTIME_V8((double) verification_result->registered_time));
+  }
 
-    double result = verification_info->implicit_data->registered_time;
-    GTVerificationInfo_free(verification_info);
-    NanReturnValue(NODE_UNIXTIME_V8(result));
+  // structural token properties, no cryptographic checks are done
+  static NAN_METHOD(GetMetadata)
+  {
+    NanScope();
+    UNWRAP_ts();
+
+    GTTimestampMetadata *metadata = NULL;
+    int res = GTTimestamp_getMetadata(ts->timestamp, &metadata);
+    ASSERT_GT_ERROR(res);
+
+    Local<Object> result = NanNew<Object>();
+    result->Set(NanNew<String>("registered_time"), NODE_UNIXTIME_V8(metadata->registered_time));
+    result->Set(NanNew<String>("location_id"), format_location_id(metadata->location_id));
+    if (metadata->location_name != NULL)
+      result->Set(NanNew<String>("location_name"), NanNew<String>(metadata->location_name));
+    result->Set(NanNew<String>("hash_algorithm"), hash_algorithm_name_as_String(metadata->hash_algorithm));
+    result->Set(NanNew<String>("publication_identifier"), NanNew<Number>(metadata->publication_identifier));
+    result->Set(NanNew<String>("publication_time"), NODE_UNIXTIME_V8(metadata->publication_identifier));
+
+    GTTimestampMetadata_free(metadata);
+    NanReturnValue(result);
   }
 
     // ts.compareHash(binary hash in Buffer, algo)  -> bit flag
@@ -353,65 +827,46 @@ public:
   }
 
 
-    // ts.checkPublication(pub. file content in Buffer) -> true/exception
+    // ts.checkPublication(PublicationsFile or pub. file content in Buffer) -> true/exception
   static NAN_METHOD(CheckPublication)
   {
     NanScope();
     UNWRAP_ts();
 
     ASSERT_IS_N_ARGS(1);
+    const GT_Time_t64 *registered_time = NULL;
+    const char *err;
+    if (GTTimestamp_isExtended(ts->timestamp) == GT_NOT_EXTENDED) {
+      const VerificationResult *verification_result;
+      err = ts->getVerificationResult(&verification_result);
+      if (err != NULL)
+        return NanThrowError(err);
+      registered_time = &verification_result->registered_time;
+    }
+
+    if (PublicationsFile::HasInstance(args[0])) {
+      PublicationsFile *pf = ObjectWrap::Unwrap<PublicationsFile>(args[0]->ToObject());
+      err = checkPublication(ts->timestamp, pf->pub, pf->digest, registered_time);
+      if (err != NULL)
+        return NanThrowError(err);
+      NanReturnValue(NanNew<Integer>(GT_PUBLICATION_CHECKED));
+    }
     ASSERT_IS_STRING_OR_BUFFER(args[0]);
 
     ssize_t len = DecodeBytes(args[0], BINARY);
     ASSERT_IS_POSITIVE(len);
 
-    int res;
-    GTPublicationsFile *pub;
     if (Buffer::HasInstance(args[0])) {
-      Local<Object> buffer_obj = args[0]->ToObject();
-      char *buffer_data = Buffer::Data(buffer_obj);
-      res = GTPublicationsFile_DERDecode(buffer_data, len, &pub);
+      err = checkPublication(ts->timestamp, Buffer::Data(args[0]->ToObject()), len, registered_time);
     } else {
       char* buf = new char[len];
       ssize_t written = DecodeWrite(buf, len, args[0], BINARY);
       assert(written == len);
-      res = GTPublicationsFile_DERDecode(buf, len, &pub);
+      err = checkPublication(ts->timestamp, buf, len, registered_time);
       delete [] buf;
     }
-    ASSERT_GT_ERROR(res);
-
-    int ext = GTTimestamp_isExtended(ts->timestamp);
-    if (ext == GT_EXTENDED)
-    {
-      res = GTTimestamp_checkPublication(ts->timestamp, pub);
-    }
-    else if (ext == GT_NOT_EXTENDED)
-    {
-      GTVerificationInfo *verification_info = NULL;
-      res = GTTimestamp_verify(ts->timestamp, 0, &verification_info);
-      if (res != GT_OK) {
-        GTPublicationsFile_free(pub);
-        ASSERT_GT_ERROR(res);
-      }
-
-      if (verification_info->verification_errors != GT_NO_FAILURES) {
-        GTVerificationInfo_free(verification_info);
-        GTPublicationsFile_free(pub);
-        return NanThrowError("TimeSignature verification error");
-      }
-
-      GT_Time_t64 history_id = verification_info->implicit_data->registered_time;
-      GTVerificationInfo_free(verification_info);
-      res = GTTimestamp_checkPublicKey(ts->timestamp, history_id, pub);
-    }
-    else
-    {
-      GTPublicationsFile_free(pub);
-      ASSERT_GT_ERROR(ext);
-    }
-
-    GTPublicationsFile_free(pub);
-    ASSERT_GT_ERROR(res);
+    if (err != NULL)
+      return NanThrowError(err);
     NanReturnValue(NanNew<Integer>(GT_PUBLICATION_CHECKED));
   }
 
@@ -421,20 +876,12 @@ public:
     NanScope();
     UNWRAP_ts();
 
-    GTVerificationInfo *verification_info = NULL;
-    int res = GTTimestamp_verify(ts->timestamp, 0, &verification_info);
-    ASSERT_GT_ERROR(res);
+    const VerificationResult *verification_result;
+    const char *err = ts->getVerificationResult(&verification_result);
+    if (err != NULL)
+      return NanThrowError(err);
 
-    if (verification_info->verification_errors != GT_NO_FAILURES) {
-      GTVerificationInfo_free(verification_info);
-      return NanThrowError("TimeSignature verification error");
-    }
-    Local<String> result = NanNew<String>(
-          (verification_info->implicit_data->location_name != NULL) ?
-            verification_info->implicit_data->location_name :
-            "");
-    GTVerificationInfo_free(verification_info);
-    NanReturnValue(result);
+    NanReturnValue(NanNew<String>(verification_result->location_name.c_str()));
   }
 
   // returns DER encoded ts token
@@ -448,9 +895,7 @@ public:
     int res = GTTimestamp_getDEREncoded(ts->timestamp, &data, &data_length);
     ASSERT_GT_ERROR(res);
 
-    Local<Object> result = NanNewBufferHandle((char *)data, data_length);
-    GT_free(data);
-    NanReturnValue(result);
+    NanReturnValue(newGTBuffer(data, data_length));
   }
 
   // Buffer = composeExtendingRequest()
@@ -465,9 +910,7 @@ public:
     int res = GTTimestamp_prepareExtensionRequest(ts->timestamp, &request, &request_length);
     ASSERT_GT_ERROR(res);
 
-    Local<Object> result = NanNewBufferHandle((char *)request, request_length);
-    GT_free(request);
-    NanReturnValue(result);
+    NanReturnValue(newGTBuffer(request, request_length));
   }
 
     // ts.extend(extending response)
@@ -502,8 +945,7 @@ public:
 
     ASSERT_GT_ERROR(res);
 
-    GTTimestamp_free(ts->timestamp);
-    ts->timestamp = new_ts;
+    ts->replaceTimestamp(new_ts);
 
     NanReturnValue(NanTrue());
   }
@@ -580,9 +1022,7 @@ public:
     }
     ASSERT_GT_ERROR(res);
 
-    Local<Object> result = NanNewBufferHandle((char *)request, request_length);
-    GT_free(request);
-    NanReturnValue(result);
+    NanReturnValue(newGTBuffer(request, request_length));
   }
 
 
@@ -618,9 +1058,7 @@ public:
     GTTimestamp_free(timestamp);
     ASSERT_GT_ERROR(res);
 
-    Local<Object> result = NanNewBufferHandle((char *)data, data_length);
-    GT_free(data);
-    NanReturnValue(result);
+    NanReturnValue(newGTBuffer(data, data_length));
   }
 
 
@@ -646,28 +1084,976 @@ public:
       assert(written == len);
     }
 
-    GTPublicationsFile *pub;
-    int res = GTPublicationsFile_DERDecode(buf, len, &pub);
+    GT_Time_t64 last_publication_time;
+    const char *err = verifyPublications(buf, len, &last_publication_time);
     if (bufferAllocated)
       delete [] buf;
-    ASSERT_GT_ERROR(res);
+    if (err != NULL)
+      return NanThrowError(err);
 
-    GTPubFileVerificationInfo *vi;
-    res = GTPublicationsFile_verify(pub,  &vi);
-    if (res != GT_OK) {
-      GTPublicationsFile_free(pub);
-      ASSERT_GT_ERROR(res);
-    }
+    NanReturnValue(NODE_UNIXTIME_V8((double) last_publication_time));
 
-    GTPublicationsFile_free(pub);
-    double result = vi->last_publication_time;
-    GTPubFileVerificationInfo_free(vi);
+  }
 
-    NanReturnValue(NODE_UNIXTIME_V8(result));
 
-  }
+  // asynchronous variants, libgt work is done in the libuv thread pool and
+  // callback(err, result) is called on the main thread.
+
+  // ts.verifyAsync(callback(err, signature_properties))
+  static NAN_METHOD(VerifyAsync)
+  {
+    NanScope();
+    UNWRAP_ts();
+
+    ASSERT_IS_N_ARGS(1);
+    ASSERT_IS_FUNCTION(args[0]);
+
+    NanAsyncQueueWorker(new VerifyWorker(
+          new NanCallback(args[0].As<Function>()), args.This()));
+    NanReturnUndefined();
+  }
+
+  // ts.checkPublicationAsync(PublicationsFile or pub. file content, callback(err, flags))
+  static NAN_METHOD(CheckPublicationAsync)
+  {
+    NanScope();
+    UNWRAP_ts();
+
+    ASSERT_IS_N_ARGS(2);
+    ASSERT_IS_FUNCTION(args[1]);
+    if (PublicationsFile::HasInstance(args[0])) {
+      NanAsyncQueueWorker(new CheckPublicationWorker(
+            new NanCallback(args[1].As<Function>()), args.This(), args[0]->ToObject()));
+      NanReturnUndefined();
+    }
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+
+    ssize_t len = DecodeBytes(args[0], BINARY);
+    ASSERT_IS_POSITIVE(len);
+
+    NanAsyncQueueWorker(new CheckPublicationWorker(
+          new NanCallback(args[1].As<Function>()), args.This(),
+          copyArgument(args[0], len), len));
+    NanReturnUndefined();
+  }
+
+  // ts.extendAsync(extending response, callback(err, result))
+  // result is true or one of the non-fatal status codes returned by extend()
+  static NAN_METHOD(ExtendAsync)
+  {
+    NanScope();
+    UNWRAP_ts();
+
+    ASSERT_IS_N_ARGS(2);
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+    ASSERT_IS_FUNCTION(args[1]);
+
+    ssize_t len = DecodeBytes(args[0], BINARY);
+    ASSERT_IS_POSITIVE(len);
+
+    NanAsyncQueueWorker(new ExtendWorker(
+          new NanCallback(args[1].As<Function>()), args.This(),
+          copyArgument(args[0], len), len));
+    NanReturnUndefined();
+  }
+
+  // TimeSignature.processResponseAsync(response, callback(err, der_token))
+  static NAN_METHOD(ProcessResponseAsync)
+  {
+    NanScope();
+
+    ASSERT_IS_N_ARGS(2);
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+    ASSERT_IS_FUNCTION(args[1]);
+
+    ssize_t len = DecodeBytes(args[0], BINARY);
+    ASSERT_IS_POSITIVE(len);
+
+    NanAsyncQueueWorker(new ProcessResponseWorker(
+          new NanCallback(args[1].As<Function>()),
+          copyArgument(args[0], len), len));
+    NanReturnUndefined();
+  }
+
+  // TimeSignature.verifyPublicationsAsync(pub. file content, callback(err, last_publication_date))
+  static NAN_METHOD(VerifyPublicationsAsync)
+  {
+    NanScope();
+
+    ASSERT_IS_N_ARGS(2);
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+    ASSERT_IS_FUNCTION(args[1]);
+
+    ssize_t len = DecodeBytes(args[0], BINARY);
+    ASSERT_IS_POSITIVE(len);
+
+    NanAsyncQueueWorker(new VerifyPublicationsWorker(
+          new NanCallback(args[1].As<Function>()),
+          copyArgument(args[0], len), len));
+    NanReturnUndefined();
+  }
+
+  // TimeSignature.verifyBatch([tokens], [hashes], PublicationsFile or content, callback(err, [statuses], [errors]))
+  // tokens are DER encoded, hashes are document hashes using tokens' hash algorithm.
+  static NAN_METHOD(VerifyBatch)
+  {
+    NanScope();
+
+    ASSERT_IS_N_ARGS(4);
+    if (!args[0]->IsArray() || !args[1]->IsArray()) {
+      return NanThrowTypeError("Tokens and hashes must be arrays");
+    }
+    bool decoded = PublicationsFile::HasInstance(args[2]);
+    if (!decoded) {
+      ASSERT_IS_STRING_OR_BUFFER(args[2]);
+    }
+    ASSERT_IS_FUNCTION(args[3]);
+
+    Local<Array> tokens = args[0].As<Array>();
+    Local<Array> hashes = args[1].As<Array>();
+    size_t n = tokens->Length();
+    if (hashes->Length() != n) {
+      return NanThrowTypeError("Number of tokens and hashes must match");
+    }
+    for (size_t i = 0; i < n; i++) {
+      ASSERT_IS_STRING_OR_BUFFER(tokens->Get(i));
+      ASSERT_IS_STRING_OR_BUFFER(hashes->Get(i));
+    }
+    Batch *batch = new Batch();
+    if (decoded) {
+      PublicationsFile *pf = ObjectWrap::Unwrap<PublicationsFile>(args[2]->ToObject());
+      batch->pub = pf->pub;
+      batch->pub_owner = false;
+      memcpy(batch->pub_digest, pf->digest, sizeof(batch->pub_digest));
+    } else {
+      ssize_t len = DecodeBytes(args[2], BINARY);
+      if (len < 0) {
+        delete batch;
+        return NanThrowTypeError("Bad argument");
+      }
+      char *buf = copyArgument(args[2], len);
+      SHA256((unsigned char *) buf, len, batch->pub_digest);
+      int res = GTPublicationsFile_DERDecode(buf, len, &batch->pub);
+      delete [] buf;
+      if (res != GT_OK) {
+        delete batch;
+        return NanThrowError(GT_getErrorString(res));
+      }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      Local<Value> token = tokens->Get(i);
+      Local<Value> hash = hashes->Get(i);
+      ssize_t token_length = DecodeBytes(token, BINARY);
+      ssize_t hash_length = DecodeBytes(hash, BINARY);
+      if (token_length < 0 || hash_length < 0) {
+        delete batch;
+        return NanThrowTypeError("Bad argument");
+      }
+      batch->tokens.push_back(copyArgument(token, token_length));
+      batch->token_lengths.push_back(token_length);
+      batch->hashes.push_back(copyArgument(hash, hash_length));
+      batch->hash_lengths.push_back(hash_length);
+    }
+    batch->statuses.resize(n, 0);
+    batch->errors.resize(n, NULL);
+    batch->callback = new NanCallback(args[3].As<Function>());
+
+    size_t chunks = threadPoolSize();
+    if (chunks > n)
+      chunks = n;
+    if (chunks == 0)
+      chunks = 1;
+    batch->chunks_pending = chunks;
+    for (size_t i = 0; i < chunks; i++)
+      NanAsyncQueueWorker(new VerifyBatchWorker(batch, n * i / chunks, n * (i + 1) / chunks, args[2]));
+    NanReturnUndefined();
+  }
+
+  // {root: Buffer, chains: [Buffer]} = TimeSignature.aggregateHashes([hashes], [algorithm])
+  // builds a hash tree so that all hashes can be signed with a single request for the root.
+  // chain of a hash is needed to verify the root token against it, see aggregationRoot().
+  static NAN_METHOD(AggregateHashes)
+  {
+    NanScope();
+
+    if (args.Length() < 1 || args.Length() > 2) {
+      return NanThrowTypeError("Wrong number of arguments");
+    }
+    if (!args[0]->IsArray()) {
+      return NanThrowTypeError("Hashes must be an array");
+    }
+    if (args.Length() == 2 && !args[1]->IsString()) {
+      return NanThrowTypeError("Optional 2nd argument must be hash algorithm name as string");
+    }
+    int hashalg_gt_id = 1;
+    if (args.Length() == 2)
+      hashalg_gt_id = getAlgoID(*String::Utf8Value(args[1]->ToString()));
+    if (hashalg_gt_id < 0) {
+      return NanThrowTypeError("Unsupported hash algorithm");
+    }
+
+    Local<Array> hashes = args[0].As<Array>();
+    size_t n = hashes->Length();
+    if (n == 0) {
+      return NanThrowTypeError("Hashes must not be empty");
+    }
+    for (size_t i = 0; i < n; i++) {
+      ASSERT_IS_STRING_OR_BUFFER(hashes->Get(i));
+      if (DecodeBytes(hashes->Get(i), BINARY) <= 0) {
+        return NanThrowTypeError("Bad argument");
+      }
+    }
+
+    std::vector<GTDataHash> leaves(n);
+    std::vector<const GTDataHash *> leaf_ptrs(n);
+    for (size_t i = 0; i < n; i++) {
+      ssize_t len = DecodeBytes(hashes->Get(i), BINARY);
+      leaves[i].digest = (unsigned char *) copyArgument(hashes->Get(i), len);
+      leaves[i].digest_length = len;
+      leaves[i].algorithm = hashalg_gt_id;
+      leaves[i].context = NULL;
+      leaf_ptrs[i] = &leaves[i];
+    }
+    GTDataHash *root = NULL;
+    std::vector<unsigned char *> chains(n);
+    std::vector<size_t> chain_lengths(n);
+    int res = GTDataHash_aggregate(&leaf_ptrs[0], n, hashalg_gt_id, &root,
+        &chains[0], &chain_lengths[0]);
+    for (size_t i = 0; i < n; i++)
+      delete [] (char *) leaves[i].digest;
+    ASSERT_GT_ERROR(res);
+
+    Local<Object> result = NanNew<Object>();
+    Local<Array> chain_array = NanNew<Array>(n);
+    for (size_t i = 0; i < n; i++) {
+      if (chains[i] == NULL)
+        chain_array->Set(i, NanNewBufferHandle(0));
+      else
+        chain_array->Set(i, newGTBuffer(chains[i], chain_lengths[i]));
+    }
+    result->Set(NanNew<String>("root"), NanNewBufferHandle((char *) root->digest, root->digest_length));
+    result->Set(NanNew<String>("chains"), chain_array);
+    GTDataHash_free(root);
+    NanReturnValue(result);
+  }
+
+  // root = TimeSignature.aggregationRoot(chain, hash)
+  // returns the tree root computed from a hash and its chain, to be used
+  // instead of the hash when verifying the token signed for aggregated hashes.
+  static NAN_METHOD(AggregationRoot)
+  {
+    NanScope();
+
+    ASSERT_IS_N_ARGS(2);
+    ASSERT_IS_STRING_OR_BUFFER(args[0]);
+    ASSERT_IS_STRING_OR_BUFFER(args[1]);
+    ssize_t chain_length = DecodeBytes(args[0], BINARY);
+    ssize_t hash_length = DecodeBytes(args[1], BINARY);
+    if (chain_length < 0) {
+      return NanThrowTypeError("Bad argument");
+    }
+    ASSERT_IS_POSITIVE(hash_length);
+
+    GTDataHash leaf;
+    leaf.digest = (unsigned char *) copyArgument(args[1], hash_length);
+    leaf.digest_length = hash_length;
+    leaf.algorithm = 0;
+    leaf.context = NULL;
+    char *chain = copyArgument(args[0], chain_length);
+    GTDataHash *root = NULL;
+    int res = GTDataHash_aggregationRoot(&leaf, (unsigned char *) chain, chain_length, &root);
+    delete [] chain;
+    delete [] (char *) leaf.digest;
+    ASSERT_GT_ERROR(res);
+
+    Local<Object> result = NanNewBufferHandle((char *) root->digest, root->digest_length);
+    GTDataHash_free(root);
+    NanReturnValue(result);
+  }
+
+  // TimeSignature.setHistoryCacheSize(entries)
+  // enables (entries > 0) or disables the process-wide cache of history hash chain
+  // calculations, which speeds up verification of many tokens from the same rounds.
+  static NAN_METHOD(SetHistoryCacheSize)
+  {
+    NanScope();
+
+    ASSERT_IS_N_ARGS(1);
+    if (!isFiniteNumber(args[0]) || args[0]->NumberValue() < 0) {
+      return NanThrowTypeError("Cache size must be a non-negative number");
+    }
+    // larger sizes would not fit the conversion; they fail to allocate anyway
+    double entries = args[0]->NumberValue();
+    if (entries > 4294967295.0)
+      entries = 4294967295.0;
+    int res = GT_setHashChainCacheSize((size_t) entries);
+    ASSERT_GT_ERROR(res);
+    NanReturnUndefined();
+  }
+
+  // {capacity, entries, hits, misses} = TimeSignature.getHistoryCacheStats()
+  static NAN_METHOD(GetHistoryCacheStats)
+  {
+    NanScope();
+
+    GTHashChainCacheStats stats;
+    GT_getHashChainCacheStats(&stats);
+    Local<Object> result = NanNew<Object>();
+    result->Set(NanNew<String>("capacity"), NanNew<Number>(stats.capacity));
+    result->Set(NanNew<String>("entries"), NanNew<Number>(stats.entries));
+    result->Set(NanNew<String>("hits"), NanNew<Number>(stats.hits));
+    result->Set(NanNew<String>("misses"), NanNew<Number>(stats.misses));
+    NanReturnValue(result);
+  }
+
+  // TimeSignature.cache.configure({capacity: entries, ttl: seconds})
+  // capacity 0 disables the cache of verification results, ttl 0 keeps entries until evicted.
+  static NAN_METHOD(ConfigureCache)
+  {
+    NanScope();
+
+    ASSERT_IS_N_ARGS(1);
+    if (!args[0]->IsObject()) {
+      return NanThrowTypeError("Argument must be an object");
+    }
+    Local<Object> options = args[0]->ToObject();
+    Local<Value> capacity = options->Get(NanNew<String>("capacity"));
+    Local<Value> ttl = options->Get(NanNew<String>("ttl"));
+    if (!capacity->IsUndefined() && (!isFiniteNumber(capacity) || capacity->NumberValue() < 0)) {
+      return NanThrowTypeError("Cache capacity must be a non-negative number");
+    }
+    if (!ttl->IsUndefined() && (!isFiniteNumber(ttl) || ttl->NumberValue() < 0)) {
+      return NanThrowTypeError("Cache ttl must be a non-negative number");
+    }
+    Local<Object> current = VerificationCache::statsAsObject();
+    if (capacity->IsUndefined())
+      capacity = current->Get(NanNew<String>("capacity"));
+    if (ttl->IsUndefined())
+      ttl = current->Get(NanNew<String>("ttl"));
+    // larger values are as good as unlimited, and would not fit the conversions
+    double capacity_entries = capacity->NumberValue(), ttl_seconds = ttl->NumberValue();
+    if (capacity_entries > 4294967295.0)
+      capacity_entries = 4294967295.0;
+    if (ttl_seconds > 1e12)
+      ttl_seconds = 1e12;
+    VerificationCache::configure((size_t) capacity_entries,
+        (uint64_t) (ttl_seconds * 1000));
+    NanReturnUndefined();
+  }
+
+  // {capacity, ttl, entries, hits, misses, evictions, expirations} = TimeSignature.cache.stats()
+  static NAN_METHOD(GetCacheStats)
+  {
+    NanScope();
+    NanReturnValue(VerificationCache::statsAsObject());
+  }
+
+  // TimeSignature.cache.clear() drops all entries and resets counters
+  static NAN_METHOD(ClearCache)
+  {
+    NanScope();
+    VerificationCache::clear();
+    NanReturnUndefined();
+  }
 
 private:
+  // number of queued async workers using this->timestamp
+  int pending;
+  // tokens replaced by extend() while async workers were still using them
+  std::vector<GTTimestamp *> retired;
+
+  void replaceTimestamp(GTTimestamp *new_ts)
+  {
+    delete verification_result;
+    verification_result = NULL;
+    if (pending > 0)
+      retired.push_back(timestamp);
+    else
+      GTTimestamp_free(timestamp);
+    timestamp = new_ts;
+  }
+
+  // returns NULL if ok, error message otherwise
+  const char *getVerificationResult(const VerificationResult **result)
+  {
+    if (verification_result == NULL) {
+      VerificationResult *tmp_result = new VerificationResult();
+      const char *err = verifyTimestamp(timestamp, tmp_result);
+      if (err != NULL) {
+        delete tmp_result;
+        return err;
+      }
+      verification_result = tmp_result;
+    }
+    *result = verification_result;
+    return NULL;
+  }
+
+  void freeRetired()
+  {
+    for (size_t i = 0; i < retired.size(); i++)
+      GTTimestamp_free(retired[i]);
+    retired.clear();
+  }
+
+  // cache key of a token, empty if VerificationCache is disabled.
+  // pub_digest identifies the publications file, NULL for VERIFY keys.
+  // returns NULL if ok, error message otherwise
+  static const char *cacheKey(VerificationCache::Kind kind, const GTTimestamp *timestamp,
+      const unsigned char *pub_digest, std::string *key)
+  {
+    key->clear();
+    if (!VerificationCache::enabled())
+      return NULL;
+
+    unsigned char *der;
+    size_t der_length;
+    int res = GTTimestamp_getDEREncoded(timestamp, &der, &der_length);
+    if (res != GT_OK)
+      return GT_getErrorString(res);
+    unsigned char token_digest[SHA256_DIGEST_LENGTH];
+    SHA256(der, der_length, token_digest);
+    GT_free(der);
+
+    *key = VerificationCache::makeKey(kind, token_digest, pub_digest);
+    return NULL;
+  }
+
+  // GTTimestamp_verify() with parsing, results of successful verifications are cached.
+  // returns NULL if ok, error message otherwise
+  static const char *verifyTimestamp(const GTTimestamp *timestamp, VerificationResult *result)
+  {
+    std::string key;
+    const char *err = cacheKey(VerificationCache::VERIFY, timestamp, NULL, &key);
+    if (err != NULL)
+      return err;
+    VerificationCache::Entry entry;
+    if (!key.empty() && VerificationCache::lookup(key, &entry)) {
+      *result = entry.result;
+      return NULL;
+    }
+
+    GTVerificationInfo *verification_info = NULL;
+    int res = GTTimestamp_verify(timestamp, 1, &verification_info);
+    if (res != GT_OK)
+      return GT_getErrorString(res);
+    if (verification_info->verification_errors != GT_NO_FAILURES) {
+      err = "TimeSignature verification error";
+    } else {
+      result->set(verification_info);
+      if (!key.empty()) {
+        entry.result = *result;
+        VerificationCache::insert(key, entry);
+      }
+    }
+    GTVerificationInfo_free(verification_info);
+    return err;
+  }
+
+  // publications file given as DER content; it is not decoded on cache hit.
+  // returns NULL if ok, error message otherwise
+  static const char *checkPublication(GTTimestamp *timestamp, const char *data, size_t len,
+      const GT_Time_t64 *registered_time = NULL)
+  {
+    unsigned char pub_digest[SHA256_DIGEST_LENGTH];
+    std::string key;
+    if (VerificationCache::enabled()) {
+      SHA256((const unsigned char *) data, len, pub_digest);
+      const char *err = cacheKey(VerificationCache::PUBLICATION, timestamp, pub_digest, &key);
+      if (err != NULL)
+        return err;
+      if (!key.empty() && VerificationCache::lookup(key))
+        return NULL;
+    }
+
+    GTPublicationsFile *pub;
+    int res = GTPublicationsFile_DERDecode(data, len, &pub);
+    if (res != GT_OK)
+      return GT_getErrorString(res);
+
+    const char *err = checkPublication(timestamp, pub, key, registered_time);
+    GTPublicationsFile_free(pub);
+    return err;
+  }
+
+  // pub_digest identifies pub in cache keys, see PublicationsFile::digest
+  // returns NULL if ok, error message otherwise
+  static const char *checkPublication(GTTimestamp *timestamp, const GTPublicationsFile *pub,
+      const unsigned char *pub_digest, const GT_Time_t64 *registered_time = NULL)
+  {
+    std::string key;
+    const char *err = cacheKey(VerificationCache::PUBLICATION, timestamp, pub_digest, &key);
+    if (err != NULL)
+      return err;
+    if (!key.empty() && VerificationCache::lookup(key))
+      return NULL;
+    return checkPublication(timestamp, pub, key, registered_time);
+  }
+
+  // key is stored in VerificationCache on success unless empty.
+  // registered_time is optional, needed for not extended token
+  static const char *checkPublication(GTTimestamp *timestamp, const GTPublicationsFile *pub,
+      const std::string &key, const GT_Time_t64 *registered_time)
+  {
+    int res;
+    int ext = GTTimestamp_isExtended(timestamp);
+    if (ext == GT_EXTENDED)
+    {
+      res = GTTimestamp_checkPublication(timestamp, pub);
+    }
+    else if (ext == GT_NOT_EXTENDED && registered_time != NULL)
+    {
+      res = GTTimestamp_checkPublicKey(timestamp, *registered_time, pub);
+    }
+    else if (ext == GT_NOT_EXTENDED)
+    {
+      VerificationResult verification_result;
+      const char *err = verifyTimestamp(timestamp, &verification_result);
+      if (err != NULL)
+        return err;
+      res = GTTimestamp_checkPublicKey(timestamp, verification_result.registered_time, pub);
+    }
+    else
+    {
+      res = ext;
+    }
+
+    if (res != GT_OK)
+      return GT_getErrorString(res);
+    if (!key.empty())
+      VerificationCache::insert(key, VerificationCache::Entry());
+    return NULL;
+  }
+
+  // returns NULL if ok, error message otherwise
+  static const char *verifyPublications(const char *data, size_t len, GT_Time_t64 *last_publication_time)
+  {
+    GTPublicationsFile *pub;
+    int res = GTPublicationsFile_DERDecode(data, len, &pub);
+    if (res != GT_OK)
+      return GT_getErrorString(res);
+
+    GTPubFileVerificationInfo *vi;
+    res = GTPublicationsFile_verify(pub,  &vi);
+    GTPublicationsFile_free(pub);
+    if (res != GT_OK)
+      return GT_getErrorString(res);
+
+    *last_publication_time = vi->last_publication_time;
+    GTPubFileVerificationInfo_free(vi);
+    return NULL;
+  }
+
+  // copies String or Buffer argument, so that it stays valid in a worker thread
+  static char *copyArgument(Handle<Value> arg, ssize_t len)
+  {
+    char *buf = new char[len];
+    if (Buffer::HasInstance(arg)) {
+      memcpy(buf, Buffer::Data(arg->ToObject()), len);
+    } else {
+      ssize_t written = DecodeWrite(buf, len, arg, BINARY);
+      assert(written == len);
+    }
+    return buf;
+  }
+
+  // base class for workers operating on a TimeSignature instance;
+  // keeps the JS object alive and the token from being freed while queued.
+  class TimeSignatureWorker : public NanAsyncWorker
+  {
+  public:
+    TimeSignatureWorker(NanCallback *callback, Handle<Object> self)
+      : NanAsyncWorker(callback)
+    {
+      SaveToPersistent("self", self);
+      ts = ObjectWrap::Unwrap<TimeSignature>(self);
+      timestamp = ts->timestamp;
+      ts->pending++;
+    }
+
+    ~TimeSignatureWorker()
+    {
+      if (--ts->pending == 0)
+        ts->freeRetired();
+    }
+
+  protected:
+    TimeSignature *ts;
+    GTTimestamp *timestamp;
+  };
+
+  class VerifyWorker : public TimeSignatureWorker
+  {
+  public:
+    VerifyWorker(NanCallback *callback, Handle<Object> self)
+      : TimeSignatureWorker(callback, self), verification_result(new VerificationResult()) {}
+
+    ~VerifyWorker()
+    {
+      delete verification_result;
+    }
+
+    void Execute()
+    {
+      const char *err = verifyTimestamp(timestamp, verification_result);
+      if (err != NULL)
+        SetErrorMessage(err);
+    }
+
+    void HandleOKCallback()
+    {
+      NanScope();
+      Local<Value> argv[] = { NanNull(), verification_result_as_Object(verification_result) };
+      if (ts->timestamp == timestamp && ts->verification_result == NULL) {
+        ts->verification_result = verification_result;
+        verification_result = NULL;
+      }
+      callback->Call(2, argv);
+    }
+
+  private:
+    VerificationResult *verification_result;
+  };
+
+  class CheckPublicationWorker : public TimeSignatureWorker
+  {
+  public:
+    CheckPublicationWorker(NanCallback *callback, Handle<Object> self, char *data, size_t len)
+      : TimeSignatureWorker(callback, self), data(data), len(len), pub(NULL), pub_digest(NULL) {}
+
+    CheckPublicationWorker(NanCallback *callback, Handle<Object> self, Handle<Object> pubobj)
+      : TimeSignatureWorker(callback, self), data(NULL), len(0)
+    {
+      SaveToPersistent("pub", pubobj);
+      PublicationsFile *pf = ObjectWrap::Unwrap<PublicationsFile>(pubobj);
+      pub = pf->pub;
+      pub_digest = pf->digest;
+    }
+
+    ~CheckPublicationWorker()
+    {
+      delete [] data;
+    }
+
+    void Execute()
+    {
+      const char *err = (pub != NULL) ?
+          checkPublication(timestamp, pub, pub_digest) :
+          checkPublication(timestamp, data, len);
+      if (err != NULL)
+        SetErrorMessage(err);
+    }
+
+    void HandleOKCallback()
+    {
+      NanScope();
+      Local<Value> argv[] = { NanNull(), NanNew<Integer>(GT_PUBLICATION_CHECKED) };
+      callback->Call(2, argv);
+    }
+
+  private:
+    char *data;
+    size_t len;
+    const GTPublicationsFile *pub;
+    const unsigned char *pub_digest;
+  };
+
+  class ExtendWorker : public TimeSignatureWorker
+  {
+  public:
+    ExtendWorker(NanCallback *callback, Handle<Object> self, char *data, size_t len)
+      : TimeSignatureWorker(callback, self), data(data), len(len), res(GT_UNKNOWN_ERROR), new_ts(NULL) {}
+
+    ~ExtendWorker()
+    {
+      delete [] data;
+      if (new_ts != NULL)
+        GTTimestamp_free(new_ts);
+    }
+
+    void Execute()
+    {
+      res = GTTimestamp_createExtendedTimestamp(timestamp, data, len, &new_ts);
+      if (res != GT_OK && res != GT_ALREADY_EXTENDED &&
+          res != GT_NONSTD_EXTEND_LATER && res != GT_NONSTD_EXTENSION_OVERDUE)
+        SetErrorMessage(GT_getErrorString(res));
+    }
+
+    void HandleOKCallback()
+    {
+      NanScope();
+      Local<Value> argv[] = { NanNull(), NanTrue() };
+      if (res == GT_OK) {
+        // token was possibly replaced by another extend() meanwhile; still newer is better
+        ts->replaceTimestamp(new_ts);
+        new_ts = NULL;
+      } else {
+        argv[1] = NanNew<Integer>(res);
+      }
+      callback->Call(2, argv);
+    }
+
+  private:
+    char *data;
+    size_t len;
+    int res;
+    GTTimestamp *new_ts;
+  };
+
+  class ProcessResponseWorker : public NanAsyncWorker
+  {
+  public:
+    ProcessResponseWorker(NanCallback *callback, char *response, size_t len)
+      : NanAsyncWorker(callback), response(response), len(len), data(NULL), data_length(0) {}
+
+    ~ProcessResponseWorker()
+    {
+      delete [] response;
+      GT_free(data);
+    }
+
+    void Execute()
+    {
+      GTTimestamp *timestamp;
+      int res = GTTimestamp_createTimestamp(response, len, &timestamp);
+      if (res == GT_OK) {
+        res = GTTimestamp_getDEREncoded(timestamp, &data, &data_length);
+        GTTimestamp_free(timestamp);
+      }
+      if (res != GT_OK)
+        SetErrorMessage(GT_getErrorString(res));
+    }
+
+    void HandleOKCallback()
+    {
+      NanScope();
+      Local<Value> argv[] = { NanNull(), newGTBuffer(data, data_length) };
+      data = NULL;
+      callback->Call(2, argv);
+    }
+
+  private:
+    char *response;
+    size_t len;
+    unsigned char *data;
+    size_t data_length;
+  };
+
+  class VerifyPublicationsWorker : public NanAsyncWorker
+  {
+  public:
+    VerifyPublicationsWorker(NanCallback *callback, char *data, size_t len)
+      : NanAsyncWorker(callback), data(data), len(len), last_publication_time(0) {}
+
+    ~VerifyPublicationsWorker()
+    {
+      delete [] data;
+    }
+
+    void Execute()
+    {
+      const char *err = verifyPublications(data, len, &last_publication_time);
+      if (err != NULL)
+        SetErrorMessage(err);
+    }
+
+    void HandleOKCallback()
+    {
+      NanScope();
+      Local<Value> argv[] = { NanNull(), NODE_UNIXTIME_V8((double) last_publication_time) };
+      callback->Call(2, argv);
+    }
+
+  private:
+    char *data;
+    size_t len;
+    GT_Time_t64 last_publication_time;
+  };
+
+  // rest of the verification of a token after GTTimestamp_verify(): document hash and publication.
+  // returns NULL if ok, error message otherwise
+  static const char *checkVerifiedToken(const GTTimestamp *timestamp,
+      const GTVerificationInfo *verification_info,
+      const unsigned char *hash, size_t hash_length,
+      const GTPublicationsFile *pub, int *status)
+  {
+    int res;
+
+    if (verification_info->verification_errors != GT_NO_FAILURES)
+      return "TimeSignature verification error";
+    *status = verification_info->verification_status;
+
+    GTDataHash dh;
+    dh.context = NULL;
+    res = GTTimestamp_getAlgorithm(timestamp, &dh.algorithm);
+    if (res != GT_OK)
+      return GT_getErrorString(res);
+    dh.digest = (unsigned char *) hash;
+    dh.digest_length = hash_length;
+    res = GTTimestamp_checkDocumentHash(timestamp, &dh);
+    if (res != GT_OK)
+      return GT_getErrorString(res);
+    *status |= GT_DOCUMENT_HASH_CHECKED;
+
+    // registered time is already known, no need to verify again as checkPublication() does
+    res = GTTimestamp_isExtended(timestamp);
+    if (res == GT_EXTENDED)
+      res = GTTimestamp_checkPublication(timestamp, pub);
+    else if (res == GT_NOT_EXTENDED)
+      res = GTTimestamp_checkPublicKey(timestamp, verification_info->implicit_data->registered_time, pub);
+    if (res != GT_OK)
+      return GT_getErrorString(res);
+    *status |= GT_PUBLICATION_CHECKED;
+
+    return NULL;
+  }
+
+  // state shared by all chunks of a verifyBatch() call; touched by worker
+  // threads only through disjoint ranges of statuses/errors.
+  struct Batch
+  {
+    std::vector<char *> tokens;
+    std::vector<size_t> token_lengths;
+    std::vector<char *> hashes;
+    std::vector<size_t> hash_lengths;
+    std::vector<int> statuses;
+    std::vector<const char *> errors;
+    GTPublicationsFile *pub;
+    bool pub_owner;
+    // SHA-256 of the publications file content, for VerificationCache keys
+    unsigned char pub_digest[SHA256_DIGEST_LENGTH];
+    NanCallback *callback;
+    int chunks_pending;
+
+    Batch() : pub(NULL), pub_owner(true), callback(NULL), chunks_pending(0) {}
+
+    ~Batch()
+    {
+      for (size_t i = 0; i < tokens.size(); i++) {
+        delete [] tokens[i];
+        delete [] hashes[i];
+      }
+      if (pub != NULL && pub_owner)
+        GTPublicationsFile_free(pub);
+      delete callback;
+    }
+  };
+
+  class VerifyBatchWorker : public NanAsyncWorker
+  {
+  public:
+    VerifyBatchWorker(Batch *batch, size_t begin, size_t end, Handle<Value> pubobj)
+      : NanAsyncWorker(NULL), batch(batch), begin(begin), end(end)
+    {
+      // keeps PublicationsFile alive while in use
+      if (pubobj->IsObject())
+        SaveToPersistent("pub", pubobj->ToObject());
+    }
+
+    // tokens of the chunk are verified together, so that their hash chains
+    // are calculated in parallel (see GTTimestamp_verifyBatch()).
+    // Cached tokens are not decoded; keys use the token bytes as given.
+    void Execute()
+    {
+      size_t n = end - begin;
+      std::vector<GTTimestamp *> timestamps(n, NULL);
+      std::vector<GTVerificationInfo *> infos(n, NULL);
+      std::vector<int> results(n, GT_OK);
+      std::vector<std::string> keys(n);
+      std::vector<bool> cached(n, false);
+
+      if (VerificationCache::enabled()) {
+        for (size_t i = 0; i < n; i++) {
+          unsigned char token_digest[SHA256_DIGEST_LENGTH];
+          SHA256((unsigned char *) batch->tokens[begin + i], batch->token_lengths[begin + i], token_digest);
+          keys[i] = VerificationCache::makeKey(VerificationCache::BATCH, token_digest, batch->pub_digest);
+          VerificationCache::Entry entry;
+          std::string document_hash(batch->hashes[begin + i], batch->hash_lengths[begin + i]);
+          if (VerificationCache::lookup(keys[i], &entry, &document_hash)) {
+            batch->statuses[begin + i] = entry.result.verification_status;
+            cached[i] = true;
+          }
+        }
+      }
+
+      for (size_t i = 0; i < n; i++) {
+        if (cached[i])
+          continue;
+        int res = GTTimestamp_DERDecode(batch->tokens[begin + i],
+            batch->token_lengths[begin + i], &timestamps[i]);
+        if (res != GT_OK) {
+          timestamps[i] = NULL;
+          batch->errors[begin + i] = GT_getErrorString(res);
+        }
+      }
+
+      // GTTimestamp_verifyBatch() skips NULL tokens
+
+      int res = n == 0 ? GT_OK : GTTimestamp_verifyBatch(&timestamps[0], n, 0, &infos[0], &results[0]);
+      for (size_t i = 0; i < n; i++) {
+        if (timestamps[i] == NULL)
+          continue;
+        if (res != GT_OK)
+          batch->errors[begin + i] = GT_getErrorString(res);
+        else if (results[i] != GT_OK)
+          batch->errors[begin + i] = GT_getErrorString(results[i]);
+        else
+          batch->errors[begin + i] = checkVerifiedToken(timestamps[i], infos[i],
+              (unsigned char *) batch->hashes[begin + i], batch->hash_lengths[begin + i],
+              batch->pub, &batch->statuses[begin + i]);
+        if (batch->errors[begin + i] == NULL && !keys[i].empty()) {
+          VerificationCache::Entry entry;
+          entry.result.verification_status = batch->statuses[begin + i];
+          entry.document_hash.assign(batch->hashes[begin + i], batch->hash_lengths[begin + i]);
+          VerificationCache::insert(keys[i], entry);
+        }
+        GTVerificationInfo_free(infos[i]);
+        GTTimestamp_free(timestamps[i]);
+      }
+    }
+
+    // last finished chunk reports results of the whole batch
+    void HandleOKCallback()
+    {
+      NanScope();
+      if (--batch->chunks_pending > 0)
+        return;
+
+      size_t n = batch->statuses.size();
+      Local<Array> statuses = NanNew<Array>(n);
+      Local<Array> errors = NanNew<Array>(n);
+      for (size_t i = 0; i < n; i++) {
+        if (batch->errors[i] == NULL) {
+          statuses->Set(i, NanNew<Integer>(batch->statuses[i]));
+          errors->Set(i, NanNull());
+        } else {
+          statuses->Set(i, NanNew<Integer>(0));
+          errors->Set(i, NanNew<String>(batch->errors[i]));
+        }
+      }
+      Local<Value> argv[] = { NanNull(), statuses, errors };
+      NanCallback *cb = batch->callback;
+      batch->callback = NULL;
+      delete batch;
+      cb->Call(3, argv);
+      delete cb;
+    }
+
+  private:
+    Batch *batch;
+    size_t begin;
+    size_t end;
+  };
+
+  // number of worker threads in libuv pool
+  static size_t threadPoolSize()
+  {
+    const char *val = getenv("UV_THREADPOOL_SIZE");
+    int n = (val != NULL) ? atoi(val) : 0;
+    return (n > 0) ? n : 4;
+  }
+
   static int getAlgoID(const char *algoName) {
       return (
           strcasecmp(algoName, "sha1") == 0 ? GT_HASHALG_SHA1 :
@@ -700,7 +2086,9 @@ extern "C" {
                            NanNew<String>(GT_getErrorString(res))));
       return;
     }
+    VerificationCache::Init();
     TimeSignature::Init(target);
+    PublicationsFile::Init(target);
 
     // If system certificate stores not detected then use Node's root certificates to
     // validate signature on publications file.
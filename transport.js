@@ -0,0 +1,402 @@
+// HTTP/1.1 client transport for the GuardTime services.
+//
+// Connections to each endpoint are kept alive between requests, and at most
+// maxinflight requests per endpoint are sent at once, the rest wait in a
+// queue. Small POST requests may be pipelined: sent on a busy connection
+// without waiting for the responses to the earlier ones.
+
+var net = require('net');
+
+var settings = {
+  keepalive:    true,   // reuse connections
+  idlesockets:  4,      // max. idle connections kept per endpoint
+  idletimeout:  30000,  // ms before an idle connection is closed
+  pipelining:   1,      // max. requests on a connection at once, 1 disables pipelining
+  pipelinesize: 1024    // max. body size of a pipelined request
+};
+
+// longest accepted status line and headers
+var MAX_HEAD = 16 * 1024;
+// largest body allocated up front from Content-Length; longer ones are
+// collected as received, so that a bogus length does not allocate memory
+var MAX_PREALLOC = 64 * 1024;
+
+
+// Incremental parser of the responses on a connection.
+function Parser(){
+  this.buffer = null;  // received data not consumed yet
+  this.next();
+}
+
+Parser.prototype.next = function(){
+  this.state = 'head';
+  this.res = null;
+  this.body = null;    // preallocated body if the length is known
+  this.chunks = [];    // body parts otherwise
+  this.length = 0;     // body bytes received
+  this.remaining = 0;  // bytes left in the body or in the current chunk
+};
+
+// true if some of the current response has been received
+Parser.prototype.started = function(){
+  return this.state !== 'head' || (this.buffer !== null && this.buffer.length > 0);
+};
+
+// line ending at or after pos in the buffer, or null if not complete yet
+Parser.prototype.line = function(pos, max){
+  var s = this.buffer.toString('binary', pos, Math.min(this.buffer.length, pos + max));
+  var i = s.indexOf('\r\n');
+  if (i < 0) {
+    if (s.length >= max)
+      throw new Error("Malformed response");
+    return null;
+  }
+  return s.substring(0, i);
+};
+
+Parser.prototype.append = function(data){
+  if (this.body)
+    data.copy(this.body, this.length);
+  else
+    this.chunks.push(data);
+  this.length += data.length;
+};
+
+Parser.prototype.complete = function(){
+  var res = this.res;
+  res.body = this.body || Buffer.concat(this.chunks, this.length);
+  this.next();
+  return res;
+};
+
+// consumes data, returns the responses completed by it; throws on malformed data
+Parser.prototype.push = function(data){
+  var done = [], pos = 0, line, n;
+  this.buffer = this.buffer ? Buffer.concat([this.buffer, data]) : data;
+  while (pos < this.buffer.length) {
+    if (this.state === 'head') {
+      var s = this.buffer.toString('binary', pos, Math.min(this.buffer.length, pos + MAX_HEAD));
+      var end = s.indexOf('\r\n\r\n');
+      if (end < 0) {
+        if (s.length >= MAX_HEAD)
+          throw new Error("Malformed response");
+        break;
+      }
+      this.res = parsehead(s.substring(0, end));
+      pos += end + 4;
+      if (this.res.statusCode < 200) {  // informational, the real response follows
+        this.next();
+        continue;
+      }
+      var size = parseInt(this.res.headers['content-length'], 10);
+      if (this.res.statusCode === 204 || this.res.statusCode === 304) {
+        done.push(this.complete());
+      } else if (/chunked/i.test(this.res.headers['transfer-encoding'] || '')) {
+        this.state = 'chunksize';
+      } else if (size >= 0) {
+        if (size <= MAX_PREALLOC)
+          this.body = new Buffer(size);
+        this.remaining = size;
+        this.state = 'body';
+        if (size === 0)
+          done.push(this.complete());
+      } else {
+        this.res.close = true;  // body ends with the connection
+        this.state = 'untilclose';
+      }
+    } else if (this.state === 'body' || this.state === 'chunk') {
+      n = Math.min(this.remaining, this.buffer.length - pos);
+      this.append(this.buffer.slice(pos, pos + n));
+      pos += n;
+      this.remaining -= n;
+      if (this.remaining === 0) {
+        if (this.state === 'body')
+          done.push(this.complete());
+        else
+          this.state = 'chunkend';
+      }
+    } else if (this.state === 'chunkend') {
+      if (this.buffer.length - pos < 2)
+        break;
+      if (this.buffer.toString('binary', pos, pos + 2) !== '\r\n')
+        throw new Error("Malformed response");
+      pos += 2;
+      this.state = 'chunksize';
+    } else if (this.state === 'chunksize') {
+      if ((line = this.line(pos, 1024)) === null)
+        break;
+      pos += line.length + 2;
+      this.remaining = parseInt(line, 16);
+      if (!(this.remaining >= 0))
+        throw new Error("Malformed response");
+      this.state = this.remaining > 0 ? 'chunk' : 'trailer';
+    } else if (this.state === 'trailer') {
+      if ((line = this.line(pos, MAX_HEAD)) === null)
+        break;
+      pos += line.length + 2;
+      if (line === '')
+        done.push(this.complete());
+    } else {  // untilclose
+      this.append(this.buffer.slice(pos));
+      pos = this.buffer.length;
+    }
+  }
+  this.buffer = pos < this.buffer.length ? this.buffer.slice(pos) : null;
+  return done;
+};
+
+// connection has ended; returns the response delimited by it, if any
+Parser.prototype.end = function(){
+  return this.state === 'untilclose' ? this.complete() : null;
+};
+
+function parsehead(head){
+  var lines = head.split('\r\n');
+  var m = /^HTTP\/1\.(\d) (\d{3})/.exec(lines[0]);
+  if (!m)
+    throw new Error("Malformed response");
+  var res = { statusCode: parseInt(m[2], 10), headers: {}, close: false };
+  for (var i = 1; i < lines.length; i++) {
+    var colon = lines[i].indexOf(':');
+    if (colon > 0)
+      res.headers[lines[i].substring(0, colon).toLowerCase()] = lines[i].substring(colon + 1).trim();
+  }
+  var connection = (res.headers.connection || '').toLowerCase();
+  res.close = connection === 'close' || (m[1] === '0' && connection !== 'keep-alive');
+  return res;
+}
+
+
+// Connection to an endpoint; requests get responses in the order they were sent.
+function Connection(endpoint){
+  var self = this;
+  this.endpoint = endpoint;
+  this.pending = [];     // requests sent, waiting for responses
+  this.served = 0;       // number of responses received
+  this.closed = false;
+  this.timer = null;
+  this.parser = new Parser();
+  this.socket = net.connect(endpoint.port, endpoint.host);
+  this.socket.setNoDelay(true);
+  this.socket.on('data', function(data){ self.ondata(data); });
+  this.socket.on('end', function(){ self.onend(); });
+  this.socket.on('error', function(err){ self.close(err); });
+  this.socket.on('close', function(){ self.close(new Error("Connection closed")); });
+}
+
+Connection.prototype.send = function(req){
+  if (this.timer) {
+    clearTimeout(this.timer);
+    this.timer = null;
+  }
+  if (this.socket.ref)
+    this.socket.ref();
+  // the server may have closed an idle connection meanwhile, or fail requests
+  // queued behind another one; such requests are sent again once.
+  req.retriable = !req.retried && (this.served > 0 || this.pending.length > 0);
+  this.pending.push(req);
+  this.socket.write(req.data);
+};
+
+// true if further small requests may be sent before the earlier ones are answered
+Connection.prototype.pipelinable = function(req){
+  if (!req.pipelinable || this.pending.length >= settings.pipelining)
+    return false;
+  for (var i = 0; i < this.pending.length; i++)
+    if (!this.pending[i].pipelinable)
+      return false;
+  return true;
+};
+
+Connection.prototype.ondata = function(data){
+  var done;
+  try {
+    done = this.parser.push(data);
+  } catch (err) {
+    return this.close(err);
+  }
+  for (var i = 0; i < done.length && !this.closed; i++)
+    this.respond(done[i]);
+};
+
+Connection.prototype.onend = function(){
+  var res = this.parser.end();
+  if (res)
+    this.respond(res);
+  this.close(new Error("Connection closed by server"));
+};
+
+Connection.prototype.respond = function(res){
+  var req = this.pending.shift();
+  if (!req)
+    return this.close(new Error("Unexpected response"));
+  this.served++;
+  if (res.close || !settings.keepalive)
+    this.close(new Error("Connection closed by server"));
+  this.endpoint.done(req, null, res);
+  if (!this.closed && this.pending.length === 0)
+    this.endpoint.idle(this);
+};
+
+Connection.prototype.wait = function(){
+  var self = this;
+  if (this.socket.unref)
+    this.socket.unref();
+  this.timer = setTimeout(function(){ self.close(null); }, settings.idletimeout);
+  if (this.timer.unref)
+    this.timer.unref();
+};
+
+Connection.prototype.close = function(err){
+  if (this.closed)
+    return;
+  this.closed = true;
+  if (this.timer)
+    clearTimeout(this.timer);
+  this.socket.destroy();
+  this.endpoint.remove(this);
+  var pending = this.pending;
+  this.pending = [];
+  for (var i = 0; i < pending.length; i++) {
+    if (pending[i].retriable && !(i === 0 && this.parser.started()))
+      this.endpoint.retry(pending[i]);
+    else
+      this.endpoint.done(pending[i], err || new Error("Connection closed"));
+  }
+};
+
+
+// Connections and queue of requests to one host, port and path.
+function Endpoint(host, port){
+  this.host = host;
+  this.port = port;
+  this.maxinflight = 1;
+  this.inflight = 0;
+  this.connections = [];
+  this.queue = [];
+}
+
+Endpoint.prototype.request = function(req){
+  this.queue.push(req);
+  this.pump();
+};
+
+Endpoint.prototype.pump = function(){
+  while (this.queue.length > 0 && this.inflight < this.maxinflight) {
+    var req = this.queue.shift();
+    this.inflight++;
+    this.pick(req).send(req);
+  }
+};
+
+// idle connection, else the least busy one the request can be pipelined on, else a new one
+Endpoint.prototype.pick = function(req){
+  var best = null, c;
+  for (var i = 0; i < this.connections.length; i++) {
+    c = this.connections[i];
+    if (c.pending.length === 0)
+      return c;
+    if (c.pipelinable(req) && (!best || c.pending.length < best.pending.length))
+      best = c;
+  }
+  if (!best) {
+    best = new Connection(this);
+    this.connections.push(best);
+  }
+  return best;
+};
+
+Endpoint.prototype.done = function(req, err, res){
+  this.inflight--;
+  req.callback(err, res);
+  this.pump();
+};
+
+Endpoint.prototype.retry = function(req){
+  this.inflight--;
+  req.retried = true;
+  this.queue.unshift(req);
+  this.pump();
+};
+
+Endpoint.prototype.idle = function(conn){
+  var idle = 0;
+  for (var i = 0; i < this.connections.length; i++)
+    if (this.connections[i].pending.length === 0)
+      idle++;
+  if (idle > settings.idlesockets)
+    conn.close(null);
+  else
+    conn.wait();
+};
+
+Endpoint.prototype.remove = function(conn){
+  var i = this.connections.indexOf(conn);
+  if (i >= 0)
+    this.connections.splice(i, 1);
+};
+
+// connections that are open, for statistics
+Endpoint.prototype.stats = function(){
+  var idle = 0;
+  for (var i = 0; i < this.connections.length; i++)
+    if (this.connections[i].pending.length === 0)
+      idle++;
+  return { connections: this.connections.length, idle: idle,
+           inflight: this.inflight, queued: this.queue.length };
+};
+
+
+var endpoints = {};
+
+// sends request to where (url.parse() result with method, headers and
+// maxinflight); callback(err, res) gets statusCode, headers and Buffer body.
+function request(where, body, callback){
+  var host = where.hostname || 'localhost',
+    port = parseInt(where.port, 10) || 80,
+    path = where.path || '/',
+    method = where.method || 'GET';
+  var key = host + ':' + port + path;
+  var endpoint = endpoints[key] || (endpoints[key] = new Endpoint(host, port));
+  endpoint.maxinflight = where.maxinflight > 0 ? where.maxinflight : 1;
+
+  if (!Buffer.isBuffer(body))
+    body = new Buffer(body || '', 'binary');
+  var head = method + ' ' + path + ' HTTP/1.1\r\n' +
+      'Host: ' + host + (port === 80 ? '' : ':' + port) + '\r\n' +
+      'Content-Length: ' + body.length + '\r\n';
+  for (var name in where.headers)
+    if (where.headers.hasOwnProperty(name) && name.toLowerCase() !== 'content-length')
+      head += name + ': ' + where.headers[name] + '\r\n';
+  if (!settings.keepalive)
+    head += 'Connection: close\r\n';
+  head += '\r\n';
+
+  endpoint.request({
+    data: Buffer.concat([new Buffer(head, 'binary'), body]),
+    pipelinable: settings.pipelining > 1 && method === 'POST' && body.length <= settings.pipelinesize,
+    callback: callback
+  });
+}
+
+// changes settings; applies to requests sent afterwards
+function configure(options){
+  for (var key in options)
+    if (settings.hasOwnProperty(key) && options[key] !== undefined)
+      settings[key] = options[key];
+}
+
+// per endpoint connection counts, keyed by 'host:port/path'
+function stats(){
+  var result = {};
+  for (var key in endpoints)
+    result[key] = endpoints[key].stats();
+  return result;
+}
+
+module.exports = {
+  settings: settings,
+  request: request,
+  configure: configure,
+  stats: stats
+};